@@ -22,12 +22,15 @@ static void app_frame_draw(arena_result scratch)
 
 static void app_frame_draw_all(arena scratch)
 {
-   // take all the scratch space left
+   // take all the scratch space left, through new so the peak covers it for scratch_reset
    size scratch_count = scratch_left(scratch, app_some_type);
+   app_some_type* all = new(&scratch, app_some_type, scratch_count);
+   if(scratch_end(scratch, all))
+      return;
 
    for(size i = 0; i < scratch_count; ++i)
    {
-      app_some_type* p = arena_offset(i, scratch, app_some_type);
+      app_some_type* p = all + i;
       p->isvalid = true;
    }
 }
@@ -69,7 +72,7 @@ void app_start(int argc, const char** argv, hw* hw)
    if(!vulkan_initialize(hw))
 		return;	// TODO: error message for vulkan init
 
-   g_frustum_create(&frustum, (f32)w, (f32)h, 90.0f);
+   g_frustum_create(&frustum, (f32)w, (f32)h, 90.0f, 0.01f, 1000.0f);
 
    hw_event_loop_start(hw, app_frame, app_input_handle);
    hw_window_close(hw);
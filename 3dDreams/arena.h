@@ -4,7 +4,9 @@
 #include <malloc.h>
 #include <stdint.h>
 #include <assert.h>
+#include <string.h>
 #include "common.h"
+#include "atomic.h"
 
 #define arena_full(a)      ((a)->beg == (a)->end)   // or empty for stub arenas
 #define arena_loop(i, a, p) for(size (i) = 0; (i) < scratch_left((a), *(p)); ++(i))
@@ -35,6 +37,11 @@
 #define new3(a, t, n)       (t*)alloc(a, sizeof(t), __alignof(t), n, 0)
 #define new4(a, t, n, f)    (t*)alloc(a, sizeof(t), __alignof(t), n, f)
 
+#define new_atomic(...)     newx(__VA_ARGS__,new4_atomic,new3_atomic,new2_atomic)(__VA_ARGS__)
+#define new2_atomic(a, t)       (t*)alloc_atomic(a, sizeof(t), __alignof(t), 1, 0)
+#define new3_atomic(a, t, n)    (t*)alloc_atomic(a, sizeof(t), __alignof(t), n, 0)
+#define new4_atomic(a, t, n, f) (t*)alloc_atomic(a, sizeof(t), __alignof(t), n, f)
+
 #define newxsize(a,b,c,d,e,...) e
 #define newsize(...)            newxsize(__VA_ARGS__,new4size,new3size,new2size)(__VA_ARGS__)
 #define new2size(a, t)          alloc(a, t, __alignof(t), 1, 0)
@@ -53,27 +60,251 @@ typedef struct
    size count;
 } arena_result;
 
+#if defined(ARENA_TELEMETRY)
+enum { ARENA_TAG_COUNT = 64 };
+
+// allocations from one call site or explicit label
+typedef struct arena_tag_stats
+{
+   const char* tag;
+   u32 line;
+   u32 count;
+   size bytes;
+   size padding;  // lost to alignment
+} arena_tag_stats;
+
+typedef struct arena_stats
+{
+   arena_tag_stats tags[ARENA_TAG_COUNT];   // the last one collects the overflow
+   u32 tag_count;
+   u32 failure_count;
+   size bytes;
+   size padding;
+   size peak;     // most bytes ever in use
+   const char* failed_tag;   // the last failing allocation
+   u32 failed_line;
+   size failed_bytes;
+} arena_stats;
+
+#define alloc(a, s, al, n, f) alloc_tagged(a, s, al, n, f, __FILE__, __LINE__)
+#else
+#define alloc(a, s, al, n, f) alloc_tagged(a, s, al, n, f, 0, 0)
+#endif
+
+// arena creation options, the platform falls back to normal pages when it cannot grant them
+enum { ARENA_HUGE_PAGES = 1 << 0 };   // back with 2 MiB pages to cut TLB misses on big arrays, growable arenas only get transparent ones
+
+// bookkeeping shared by every copy of an arena, lives at the base of its reservation
+align_struct arena_header
+{
+   byte* commit;  // one past the committed pages
+   byte* end;     // one past the reserved pages
+   byte* peak;    // high-water mark of every copy since the last reset
+   size chunk;    // commit granularity, zero when committed up front
+   u32 flags;     // the ARENA_* options the platform could grant
+#if defined(ARENA_TELEMETRY)
+   arena_stats stats;
+#endif
+} arena_header;
+
 typedef struct arena
 {
    byte* beg;
    byte* end;  // one past the end
+   arena_header* header;   // zero for stub arenas
 } arena;
 
-static void* alloc(arena* a, size alloc_size, size align, size count, u32 flag)
+#define arena_first(h) ((byte*)((h) + 1))
+
+// Every platform should define these, the commit bookkeeping on top of them lives below
+bool arena_pages_commit(void* address, size bytes);     // makes reserved pages usable
+void arena_pages_decommit(void* address, size bytes);   // gives the pages back and keeps them reserved
+
+// Every thread that allocates temporaries creates its own pair of scratch arenas
+bool scratch_thread_create(size cap);
+void scratch_thread_release(void);
+arena scratch_get(const arena* conflict);   // a scratch not sharing memory with conflict
+
+// Commits whole chunks of a growable arena up to atleast end
+static bool arena_commit(arena_header* header, byte* end)
+{
+   pre(header->chunk > 0);
+   pre(end > header->commit);
+
+   if(end > header->end)
+      return false;
+
+   // round up to whole chunks but never past the reservation
+   size bytes = ((end - header->commit) + header->chunk - 1) / header->chunk * header->chunk;
+   if(bytes > header->end - header->commit)
+      bytes = header->end - header->commit;
+
+   if(!arena_pages_commit(header->commit, bytes))
+      return false;
+
+   header->commit += bytes;
+
+   post(header->commit >= end);
+
+   return true;
+}
+
+// Gives back the chunks of a growable arena after keep
+static void arena_decommit(arena_header* header, byte* keep)
+{
+   pre(header->chunk > 0);
+
+   // commits happen in whole chunks from the base and the first one holds the header
+   size offset = ((keep - (byte*)header) + header->chunk - 1) / header->chunk * header->chunk;
+   if(offset < header->chunk)
+      offset = header->chunk;
+
+   byte* page = (byte*)header + offset;
+   if(page >= header->commit)
+      return;
+
+   arena_pages_decommit(page, header->commit - page);
+   header->commit = page;
+}
+
+#if defined(ARENA_TELEMETRY)
+static void arena_stats_record(arena_header* header, const char* tag, u32 line, size bytes, size padding)
+{
+   arena_stats* stats = &header->stats;
+   u32 i;
+
+   for(i = 0; i < stats->tag_count; ++i)
+      if(stats->tags[i].line == line && (stats->tags[i].tag == tag || strcmp(stats->tags[i].tag, tag) == 0))
+         break;
+
+   if(i == stats->tag_count)
+   {
+      if(stats->tag_count < ARENA_TAG_COUNT)
+         stats->tag_count++;
+      else
+         i = ARENA_TAG_COUNT - 1, tag = "other", line = 0;
+
+      stats->tags[i].tag = tag;
+      stats->tags[i].line = line;
+   }
+
+   stats->tags[i].count++;
+   stats->tags[i].bytes += bytes;
+   stats->tags[i].padding += padding;
+
+   stats->bytes += bytes;
+   stats->padding += padding;
+}
+
+static void arena_stats_failure(arena_header* header, const char* tag, u32 line, size bytes)
+{
+   header->stats.failure_count++;
+   header->stats.failed_tag = tag;
+   header->stats.failed_line = line;
+   header->stats.failed_bytes = bytes;
+}
+
+// Zero for stub arenas
+static const arena_stats* arena_stats_get(const arena* a)
+{
+   return a->header ? &a->header->stats : 0;
+}
+
+static void arena_stats_dump(const arena* a, const char* name, void (*print)(const char* format, ...))
+{
+   const arena_stats* stats = arena_stats_get(a);
+   if(!stats)
+      return;
+
+   // u32 casts since not every platform printf knows 64 bit sizes
+   print("arena %s: %u bytes, %u padding, %u peak, %u failures\n", name,
+         (u32)stats->bytes, (u32)stats->padding, (u32)stats->peak, stats->failure_count);
+
+   if(stats->failure_count > 0)
+      print("   last failure %s(%u): %u bytes\n", stats->failed_tag, stats->failed_line, (u32)stats->failed_bytes);
+
+   for(u32 i = 0; i < stats->tag_count; ++i)
+      print("   %s(%u): %u allocs, %u bytes, %u padding\n", stats->tags[i].tag, stats->tags[i].line,
+            stats->tags[i].count, (u32)stats->tags[i].bytes, (u32)stats->tags[i].padding);
+}
+#endif
+
+static void* alloc_tagged(arena* a, size alloc_size, size align, size count, u32 flag, const char* tag, u32 line)
 {
    // align allocation to next aligned boundary
    void* p = (void*)(((uptr)a->beg + (align - 1)) & (-align));
 
    if(count <= 0 || count > (a->end - (byte*)p) / alloc_size) // empty or overflow
+   {
+#if defined(ARENA_TELEMETRY)
+      if(a->header)
+         arena_stats_failure(a->header, tag, line, count*alloc_size);
+#endif
       return a->end;
+   }
+
+   byte* next = (byte*)p + (count * alloc_size);
+
+   // growable arenas commit the next chunks on demand
+   if(a->header && next > a->header->commit)
+      if(!arena_commit(a->header, next))
+      {
+#if defined(ARENA_TELEMETRY)
+         arena_stats_failure(a->header, tag, line, count*alloc_size);
+#endif
+         return a->end;
+      }
+
+#if defined(ARENA_TELEMETRY)
+   if(a->header)
+   {
+      arena_stats_record(a->header, tag, line, count*alloc_size, (byte*)p - a->beg);
+      if(next - arena_first(a->header) > a->header->stats.peak)
+         a->header->stats.peak = next - arena_first(a->header);
+   }
+#endif
+
+   a->beg = next;          // advance arena 
 
-   a->beg = (byte*)p + (count * alloc_size);          // advance arena 
+   if(a->header && next > a->header->peak)
+      a->header->peak = next;
 
    post(((uptr)p & (align - 1)) == 0);   // aligned result
 
    return p;
 }
 
+// Lock free bump for an arena shared by many threads. Committing is not thread safe, so a growable
+// arena only hands out the pages it has committed already. Takes the same flags as alloc
+static void* alloc_atomic(arena* a, size alloc_size, size align, size count, u32 flag)
+{
+   byte* end = a->header && a->header->chunk > 0 ? a->header->commit : a->end;
+
+   void* beg = atomic_load_ptr((void* volatile*)&a->beg);
+
+   for(;;)
+   {
+      // align allocation to next aligned boundary from the cursor we saw
+      byte* p = (byte*)(((uptr)beg + (align - 1)) & (-align));
+
+      if(count <= 0 || p > end || count > (end - p) / alloc_size) // empty or overflow
+         return a->end;
+
+      byte* next = p + (count * alloc_size);
+
+      // someone else bumped first, retry from their cursor
+      if(!atomic_cas_ptr((void* volatile*)&a->beg, &beg, next))
+         continue;
+
+      if(a->header)
+         atomic_max_ptr((void* volatile*)&a->header->peak, next);
+
+      post(((uptr)p & (align - 1)) == 0);   // aligned result
+
+      return p;
+   }
+}
+
 static arena_result arena_alloc(arena scratch, size objsize, size count)
 {
    arena_result result = {};
@@ -84,3 +315,68 @@ static arena_result arena_alloc(arena scratch, size objsize, size count)
 
    return result;
 }
+
+// position to roll a long-lived arena back to after transient allocations
+typedef struct arena_checkpoint
+{
+   byte* beg;
+} arena_checkpoint;
+
+static arena_checkpoint arena_mark(const arena* a)
+{
+   arena_checkpoint result = {a->beg};
+   return result;
+}
+
+// releases everything allocated after the mark
+static void arena_rewind(arena* a, arena_checkpoint mark)
+{
+   pre(mark.beg && mark.beg <= a->beg);
+
+#ifdef _DEBUG
+   // poison the released bytes so stale pointers show up
+   memset(mark.beg, 0xcd, a->beg - mark.beg);
+#endif
+
+   a->beg = mark.beg;
+}
+
+// keeps the first bytes of the last allocation p and releases the rest, for results sized for the worst case
+static void arena_shrink_to(arena* a, void* p, size bytes)
+{
+   pre(p && bytes >= 0 && (byte*)p + bytes <= a->beg);
+
+   arena_checkpoint tail = {(byte*)p + bytes};
+   arena_rewind(a, tail);
+}
+
+// rewinds the arena to its first byte, growable arenas also decommit past the keep watermark
+static void arena_reset(arena* a, size keep)
+{
+   pre(a->header);
+
+   a->beg = arena_first(a->header);
+
+   if(a->header->chunk > 0 && keep >= 0 && keep < a->end - a->beg)
+      arena_decommit(a->header, a->beg + keep);
+
+   // decommitted pages come back zeroed
+   if(a->header->peak > a->header->commit)
+      a->header->peak = a->header->commit;
+
+   post(a->beg == arena_first(a->header));
+}
+
+// clears only the bytes touched past a->beg since the last reset, without zero it just rewinds the mark
+static void scratch_reset(arena* a, bool zero)
+{
+   if(!a->header || a->header->peak <= a->beg)
+      return;
+
+   if(zero)
+      memset(a->beg, 0, a->header->peak - a->beg);
+
+   a->header->peak = a->beg;
+
+   post(a->header->peak == a->beg);
+}
@@ -0,0 +1,119 @@
+#if !defined(_ATOMIC_H)
+#define _ATOMIC_H
+
+#include "common.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+// Full barrier compare and swap, on failure expected gets the current value
+static inline bool atomic_cas_ptr(void* volatile* dst, void** expected, void* desired)
+{
+#if defined(_MSC_VER)
+   void* prev = _InterlockedCompareExchangePointer(dst, desired, *expected);
+   if(prev == *expected)
+      return true;
+   *expected = prev;
+   return false;
+#else
+   return __atomic_compare_exchange_n(dst, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void* atomic_load_ptr(void* volatile* src)
+{
+#if defined(_MSC_VER)
+   void* result = *src;
+   _ReadWriteBarrier();
+   return result;
+#else
+   return __atomic_load_n(src, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// Raises dst to atleast value
+static inline void atomic_max_ptr(void* volatile* dst, void* value)
+{
+   void* current = atomic_load_ptr(dst);
+   while((byte*)current < (byte*)value)
+      if(atomic_cas_ptr(dst, &current, value))
+         break;
+}
+
+// Returns the old value, full barrier
+static inline u32 atomic_exchange_u32(volatile u32* dst, u32 value)
+{
+#if defined(_MSC_VER)
+   return (u32)_InterlockedExchange((volatile long*)dst, (long)value);
+#else
+   return __atomic_exchange_n(dst, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline u32 atomic_load_u32(volatile u32* src)
+{
+#if defined(_MSC_VER)
+   u32 result = *src;
+   _ReadWriteBarrier();
+   return result;
+#else
+   return __atomic_load_n(src, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void atomic_store_u32(volatile u32* dst, u32 value)
+{
+#if defined(_MSC_VER)
+   _ReadWriteBarrier();
+   *dst = value;
+#else
+   __atomic_store_n(dst, value, __ATOMIC_RELEASE);
+#endif
+}
+
+// 64 bit loads and stores are single instructions on the 64 bit targets
+static inline u64 atomic_load_u64(volatile u64* src)
+{
+#if defined(_MSC_VER)
+   u64 result = *src;
+   _ReadWriteBarrier();
+   return result;
+#else
+   return __atomic_load_n(src, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void atomic_store_u64(volatile u64* dst, u64 value)
+{
+#if defined(_MSC_VER)
+   _ReadWriteBarrier();
+   *dst = value;
+#else
+   __atomic_store_n(dst, value, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline void atomic_pause()
+{
+#if defined(_MSC_VER)
+   _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+   __builtin_ia32_pause();
+#endif
+}
+
+// Gives up the rest of the time slice, spinning on a lock whose holder was preempted only keeps it off the core
+static inline void atomic_yield()
+{
+#if defined(_MSC_VER)
+   SwitchToThread();
+#else
+   sched_yield();
+#endif
+}
+
+#endif
@@ -0,0 +1,1087 @@
+// Microbenchmarks of the math, geometry and memory kernels, standalone and Linux only.
+//
+//    cc -std=gnu11 -O2 -march=native -DUSE_SIMD bench.c -o bench -lpthread -lm
+//    ./bench [name filter]
+//
+// Prints one csv row per kernel, variant and size with the best time per item of a few runs and
+// the matching throughput, vertices per second for the transform kernels.
+// The inline vec4/mat4/quat math picks its backend at compile time, build once more without
+// USE_SIMD to get the scalar rows for it. Kernels with explicit scalar and simd versions are all
+// measured in one build.
+
+#if !defined(__linux__)
+#error "The benchmark runs on Linux"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "hw.h"
+#include "linux_memory.c"
+#include "graphics.h"
+#include "fixed_point.h"
+#include "clip.h"
+#include "bvh.h"
+
+enum { BENCH_QUEUE_MAX_COUNT = 1024*1024 };
+
+typedef struct bench_node
+{
+   usize index;
+   u32 element;
+} bench_node;
+
+#define priority_queue_type bench_node
+#define priority_queue_max_count BENCH_QUEUE_MAX_COUNT
+#include "priority_queue.h"
+
+#define indexed_queue_key usize
+#include "indexed_queue.h"
+#include "radix_sort.h"
+#include "multi_queue.h"
+
+// The binary heap priority_queue.h had before, kept to measure against. Float parent math,
+// a run time min or max branch and a sift down that never looks at the last child.
+typedef struct legacy_queue
+{
+   bench_node elements[BENCH_QUEUE_MAX_COUNT];
+   usize count;
+} legacy_queue;
+
+#define legacy_queue_lc(i) (2*(i))+1
+#define legacy_queue_root(i) (usize)(((f32)(i)/2.0f)-0.5f)
+
+static void legacy_queue_swap(bench_node* a, bench_node* b)
+{
+   bench_node t = *b;
+   *b = *a;
+   *a = t;
+}
+
+static void legacy_queue_insert(legacy_queue* queue, bench_node data)
+{
+   queue->count++;
+   queue->elements[queue->count - 1] = data;
+
+   usize child = queue->count - 1;
+   usize parent = legacy_queue_root(child);
+
+   while(parent >= 0)
+   {
+      if(queue->elements[parent].index > queue->elements[child].index)
+      {
+         legacy_queue_swap(&queue->elements[parent], &queue->elements[child]);
+         child = parent;
+         parent = legacy_queue_root(parent);
+      }
+      else break;
+   }
+}
+
+static bench_node legacy_queue_remove(legacy_queue* queue)
+{
+   bench_node result = queue->elements[0];
+   queue->elements[0] = queue->elements[queue->count - 1];
+   queue->count--;
+
+   usize parent = 0, child = 1;
+   while(child + 1 < queue->count)
+   {
+      if(queue->elements[child].index > queue->elements[child + 1].index)
+         child = child + 1;
+      if(queue->elements[child].index < queue->elements[parent].index)
+      {
+         legacy_queue_swap(&queue->elements[parent], &queue->elements[child]);
+         parent = child;
+         child = legacy_queue_lc(child);
+      }
+      else break;
+   }
+
+   return result;
+}
+
+#if defined(G_SIMD_AVX)
+#define BENCH_BACKEND "avx"
+#elif defined(G_SIMD_SSE)
+#define BENCH_BACKEND "sse"
+#elif defined(G_SIMD_NEON)
+#define BENCH_BACKEND "neon"
+#else
+#define BENCH_BACKEND "scalar"
+#endif
+
+enum { BENCH_MAX_COUNT = 256*1024, BENCH_REPEATS = 5, BENCH_THREADS = 4, BENCH_QUEUE_THREADS = 8 };
+
+#define BENCH_MIN_SECONDS 0.01
+
+static const size bench_sizes[] = {64, 4096, BENCH_MAX_COUNT};
+static const size bench_queue_sizes[] = {4*1024, 64*1024, BENCH_QUEUE_MAX_COUNT};
+static const size bench_sort_sizes[] = {4*1024, 100*1000, BENCH_QUEUE_MAX_COUNT};
+
+typedef struct bench_data
+{
+   size n;
+   arena scratch;
+
+   mat4* ma;
+   mat4* mb;
+   mat4* mr;
+   vec4* v;
+   quat* qa;
+   quat* qb;
+   trs* ta;
+   trs* tb;
+   f32* faces;       // 9 floats each
+   f32* x;           // structure of arrays positions, radii and extents
+   f32* y;
+   f32* z;
+   f32* r;
+   f32* ox;
+   f32* oy;
+   f32* oz;
+   f32* ow;
+   u32* visible;
+   fp* fa;
+   fp* fb;
+   fp* fc;
+   vec4* clip;       // clip space triangles
+   g_aabb* boxes;
+   g_frustum frustum;
+   g_plane plane;
+   bvh tree;
+   arena storage;
+   arena shared;     // committed up front for alloc_atomic
+   byte** blocks;    // what the contention threads were handed, to check afterwards
+
+   priority_queue* queue;
+   legacy_queue* legacy;
+   bench_node* nodes;
+   bench_node* moved;   // the nodes with slightly changed keys, the next frame of a streaming queue
+   indexed_queue indexed;
+   u64* sort_keys;
+   u32* sort_values;
+   bench_node* sort_nodes;
+   u32 arity;
+   u32 threads;
+} bench_data;
+
+typedef void (*bench_function)(bench_data* data, size iterations);
+
+static const char* bench_filter = 0;
+static volatile f32 bench_sink;
+
+static f64 bench_now()
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+
+   return (f64)t.tv_sec + (f64)t.tv_nsec*1e-9;
+}
+
+static f32 bench_random()
+{
+   return (f32)rand() / (f32)RAND_MAX*2.0f - 1.0f;
+}
+
+// Doubles the iterations until a run takes long enough, then keeps the best of a few runs
+static void bench_run(const char* name, const char* variant, size n, bench_function function, bench_data* data)
+{
+   if(bench_filter && !strstr(name, bench_filter))
+      return;
+
+   data->n = n;
+
+   size iterations = 1;
+   f64 elapsed = 0.0;
+   for(;;)
+   {
+      f64 start = bench_now();
+      function(data, iterations);
+      elapsed = bench_now() - start;
+
+      if(elapsed >= BENCH_MIN_SECONDS)
+         break;
+      iterations *= 2;
+   }
+
+   f64 best = elapsed;
+   for(i32 i = 0; i < BENCH_REPEATS; ++i)
+   {
+      f64 start = bench_now();
+      function(data, iterations);
+      elapsed = bench_now() - start;
+
+      best = elapsed < best ? elapsed : best;
+   }
+
+   const f64 seconds_per_item = best / ((f64)iterations*(f64)n);
+   printf("%s,%s,%td,%.3f,%.0f\n", name, variant, n, seconds_per_item*1e9, 1.0 / seconds_per_item);
+   fflush(stdout);
+}
+
+static void bench_mat4_mul(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         d->mr[i] = mat4_mul(d->ma[i], d->mb[i]);
+   bench_sink = d->mr[d->n - 1].data[0];
+}
+
+static void bench_vec4_transform(bench_data* d, size iterations)
+{
+   vec4 sum = {0};
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         sum = vec4_add(sum, vec4_transform(d->v[i], d->ma[i]));
+   bench_sink = sum.x;
+}
+
+static void bench_mat4_inverse(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         d->mr[i] = mat4_inverse(d->ma[i]);
+   bench_sink = d->mr[d->n - 1].data[0];
+}
+
+static void bench_mat4_inverse_affine(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         d->mr[i] = mat4_inverse_affine(d->mb[i]);
+   bench_sink = d->mr[d->n - 1].data[0];
+}
+
+static void bench_quat_mul(bench_data* d, size iterations)
+{
+   quat q = quat_identity();
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         q = vec4_add(q, quat_mul(d->qa[i], d->qb[i]));
+   bench_sink = q.x;
+}
+
+static void bench_quat_slerp(bench_data* d, size iterations)
+{
+   quat q = quat_identity();
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         q = vec4_add(q, quat_slerp(d->qa[i], d->qb[i], 0.3f));
+   bench_sink = q.x;
+}
+
+static void bench_quat_to_mat4(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         d->mr[i] = quat_to_mat4(d->qa[i]);
+   bench_sink = d->mr[d->n - 1].data[0];
+}
+
+static void bench_trs_mul(bench_data* d, size iterations)
+{
+   f32 sum = 0.0f;
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         sum += trs_mul(d->ta[i], d->tb[i]).translation.x;
+   bench_sink = sum;
+}
+
+static void bench_trs_to_mat4_mul(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         d->mr[i] = mat4_mul(trs_to_mat4(d->ta[i]), trs_to_mat4(d->tb[i]));
+   bench_sink = d->mr[d->n - 1].data[0];
+}
+
+static void bench_plane_classify_face(bench_data* d, size iterations)
+{
+   i32 sum = 0;
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         sum += g_plane_classify_face_side(&d->plane, d->faces + i*9);
+   bench_sink = (f32)sum;
+}
+
+static void bench_plane_intersect_segment(bench_data* d, size iterations)
+{
+   f32 sum = 0.0f;
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+      {
+         f32 vi[3] = {0};
+         g_plane_intersect_segment(&d->plane, d->faces + i*9, d->faces + i*9 + 3, vi);
+         sum += vi[0];
+      }
+   bench_sink = sum;
+}
+
+static void bench_frustum_create(bench_data* d, size iterations)
+{
+   g_frustum f;
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         g_frustum_create(&f, 800.0f + (f32)i, 600.0f, 90.0f, 0.1f, 1000.0f);
+   bench_sink = f.l.d;
+}
+
+static void bench_frustum_from_matrix(bench_data* d, size iterations)
+{
+   g_frustum f;
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         g_frustum_from_matrix(&f, d->ma[i]);
+   bench_sink = f.l.d;
+}
+
+static void bench_transform_soa_scalar(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+      g_transform_soa_scalar(d->ma[0], d->x, d->y, d->z, d->n, d->ox, d->oy, d->oz, d->ow, true);
+   bench_sink = d->ox[0];
+}
+
+static void bench_cull_spheres_scalar(bench_data* d, size iterations)
+{
+   size count = 0;
+   for(size k = 0; k < iterations; ++k)
+      count += g_frustum_cull_spheres_scalar(&d->frustum, d->x, d->y, d->z, d->r, d->n, d->visible);
+   bench_sink = (f32)count;
+}
+
+static void bench_cull_aabbs_scalar(bench_data* d, size iterations)
+{
+   size count = 0;
+   for(size k = 0; k < iterations; ++k)
+      count += g_frustum_cull_aabbs_scalar(&d->frustum, d->x, d->y, d->z, d->r, d->r, d->r, d->n, d->visible);
+   bench_sink = (f32)count;
+}
+
+#if defined(G_SIMD_SSE)
+static void bench_transform_soa_sse(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+      g_transform_soa_sse(d->ma[0], d->x, d->y, d->z, d->n, d->ox, d->oy, d->oz, d->ow, true);
+   bench_sink = d->ox[0];
+}
+
+static void bench_cull_spheres_sse(bench_data* d, size iterations)
+{
+   size count = 0;
+   for(size k = 0; k < iterations; ++k)
+      count += g_frustum_cull_spheres_sse(&d->frustum, d->x, d->y, d->z, d->r, d->n, d->visible);
+   bench_sink = (f32)count;
+}
+
+static void bench_cull_aabbs_sse(bench_data* d, size iterations)
+{
+   size count = 0;
+   for(size k = 0; k < iterations; ++k)
+      count += g_frustum_cull_aabbs_sse(&d->frustum, d->x, d->y, d->z, d->r, d->r, d->r, d->n, d->visible);
+   bench_sink = (f32)count;
+}
+#endif
+
+#if defined(G_SIMD_AVX)
+static void bench_transform_soa_avx(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+      g_transform_soa_avx(d->ma[0], d->x, d->y, d->z, d->n, d->ox, d->oy, d->oz, d->ow, true);
+   bench_sink = d->ox[0];
+}
+
+static void bench_cull_spheres_avx(bench_data* d, size iterations)
+{
+   size count = 0;
+   for(size k = 0; k < iterations; ++k)
+      count += g_frustum_cull_spheres_avx(&d->frustum, d->x, d->y, d->z, d->r, d->n, d->visible);
+   bench_sink = (f32)count;
+}
+
+static void bench_cull_aabbs_avx(bench_data* d, size iterations)
+{
+   size count = 0;
+   for(size k = 0; k < iterations; ++k)
+      count += g_frustum_cull_aabbs_avx(&d->frustum, d->x, d->y, d->z, d->r, d->r, d->r, d->n, d->visible);
+   bench_sink = (f32)count;
+}
+#endif
+
+static void bench_fixed_mul(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i < d->n; ++i)
+         d->fc[i] = FP_fixed_mul(d->fa[i], d->fb[i], FP_Q16_16);
+   bench_sink = (f32)d->fc[d->n - 1];
+}
+
+static void bench_fixed4_mul(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+      for(size i = 0; i + 4 <= d->n; i += 4)
+         FP_fixed4_store(FP_fixed4_mul(FP_fixed4_load(d->fa + i), FP_fixed4_load(d->fb + i), FP_Q16_16), d->fc + i);
+   bench_sink = (f32)d->fc[d->n - 1];
+}
+
+static void bench_clip_triangles(bench_data* d, size iterations)
+{
+   size count = 0;
+   for(size k = 0; k < iterations; ++k)
+   {
+      arena scratch = d->scratch;
+      count += g_clip_triangles(&scratch, d->clip, d->n, 2.0f).count;
+   }
+   bench_sink = (f32)count;
+}
+
+static void bench_bvh_build(bench_data* d, size iterations)
+{
+   u32 count = 0;
+   for(size k = 0; k < iterations; ++k)
+   {
+      arena storage = d->scratch;
+      arena scratch = {0};
+      // the top half of the scratch arena is scratch for the build
+      scratch.beg = storage.beg + scratch_size(storage)/2;
+      scratch.end = storage.end;
+      storage.end = scratch.beg;
+
+      count += bvh_build(&storage, scratch, d->boxes, (u32)d->n).node_count;
+   }
+   bench_sink = (f32)count;
+}
+
+static void bench_bvh_query_frustum(bench_data* d, size iterations)
+{
+   u32 count = 0;
+   for(size k = 0; k < iterations; ++k)
+      count += bvh_query_frustum(&d->tree, d->boxes, &d->frustum, d->scratch, d->visible);
+   bench_sink = (f32)count;
+}
+
+static void bench_arena_alloc(bench_data* d, size iterations)
+{
+   byte* last = 0;
+   for(size k = 0; k < iterations; ++k)
+   {
+      arena_checkpoint mark = arena_mark(&d->storage);
+      for(size i = 0; i < d->n; ++i)
+         last = alloc(&d->storage, 32, 16, 1, 0);
+      arena_rewind(&d->storage, mark);
+   }
+   bench_sink = (f32)(uptr)last;
+}
+
+static void bench_arena_alloc_atomic(bench_data* d, size iterations)
+{
+   byte* last = 0;
+   for(size k = 0; k < iterations; ++k)
+   {
+      arena_checkpoint mark = arena_mark(&d->shared);
+      for(size i = 0; i < d->n; ++i)
+         last = alloc_atomic(&d->shared, 32, 16, 1, 0);
+      arena_rewind(&d->shared, mark);
+   }
+   bench_sink = (f32)(uptr)last;
+}
+
+// Threads allocating from one shared arena at the same time
+typedef struct bench_thread
+{
+   bench_data* data;
+   pthread_mutex_t* mutex;
+   byte** blocks;
+   size count;
+} bench_thread;
+
+enum { BENCH_BLOCK_SIZE = 32 };
+
+static void* bench_thread_alloc_atomic(void* p)
+{
+   bench_thread* t = p;
+   for(size i = 0; i < t->count; ++i)
+      t->blocks[i] = alloc_atomic(&t->data->shared, BENCH_BLOCK_SIZE, 16, 1, 0);
+   return 0;
+}
+
+static void* bench_thread_alloc_mutex(void* p)
+{
+   bench_thread* t = p;
+   for(size i = 0; i < t->count; ++i)
+   {
+      pthread_mutex_lock(t->mutex);
+      t->blocks[i] = alloc(&t->data->shared, BENCH_BLOCK_SIZE, 16, 1, 0);
+      pthread_mutex_unlock(t->mutex);
+   }
+   return 0;
+}
+
+// The blocks have to tile the used range exactly, one slot each, or the run is wrong and stops
+static void bench_arena_contention_check(bench_data* d, arena_checkpoint mark, size count)
+{
+   byte* first = (byte*)(((uptr)mark.beg + 15) & ~(uptr)15);
+   bool ok = d->shared.beg - first == count*BENCH_BLOCK_SIZE;
+
+   // a byte per slot in the scratch arena, set once per block
+   arena scratch = d->scratch;
+   byte* seen = new(&scratch, byte, count);
+   ok = ok && !scratch_end(scratch, seen);
+   if(ok)
+      memset(seen, 0, count);
+
+   for(size i = 0; ok && i < count; ++i)
+   {
+      size offset = d->blocks[i] - first;
+      ok = offset >= 0 && offset % BENCH_BLOCK_SIZE == 0 && offset / BENCH_BLOCK_SIZE < count && !seen[offset / BENCH_BLOCK_SIZE];
+      if(ok)
+         seen[offset / BENCH_BLOCK_SIZE] = 1;
+   }
+
+   if(!ok)
+   {
+      fprintf(stderr, "bench: arena contention handed out overlapping or missing blocks\n");
+      exit(1);
+   }
+}
+
+static void bench_arena_contention(bench_data* d, size iterations, void* (*function)(void*))
+{
+   pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+   pthread_t threads[BENCH_THREADS];
+   bench_thread args[BENCH_THREADS];
+
+   const size count = d->n / BENCH_THREADS;
+
+   for(size k = 0; k < iterations; ++k)
+   {
+      arena_checkpoint mark = arena_mark(&d->shared);
+
+      for(i32 i = 0; i < BENCH_THREADS; ++i)
+      {
+         args[i].data = d;
+         args[i].mutex = &mutex;
+         args[i].blocks = d->blocks + i*count;
+         args[i].count = count;
+         pthread_create(&threads[i], 0, function, &args[i]);
+      }
+      for(i32 i = 0; i < BENCH_THREADS; ++i)
+         pthread_join(threads[i], 0);
+
+      // only the last run is checked, the check would otherwise dominate the time
+      if(k == iterations - 1)
+         bench_arena_contention_check(d, mark, count*BENCH_THREADS);
+
+      arena_rewind(&d->shared, mark);
+   }
+}
+
+// Every thread pushes its share of the nodes and pops after each second push, producers and
+// consumers at once, then drains. One item is one push and one pop
+typedef struct bench_queue_thread
+{
+   bench_data* data;
+   multi_queue* multi;
+   pthread_mutex_t* mutex;
+   size first;
+   size count;
+   u64 sum;          // of the popped values
+   size popped;
+   bool failed;      // a push found no room
+} bench_queue_thread;
+
+static void* bench_thread_multi_queue(void* p)
+{
+   bench_queue_thread* t = p;
+   const bench_node* nodes = t->data->nodes + t->first;
+   multi_queue_entry entry;
+
+   for(size i = 0; i < t->count; ++i)
+   {
+      t->failed |= !multi_queue_push(t->multi, nodes[i].index, nodes[i].element);
+      if((i & 1) && multi_queue_pop(t->multi, &entry))
+         t->sum += entry.value, t->popped++;
+   }
+   while(multi_queue_pop(t->multi, &entry))
+      t->sum += entry.value, t->popped++;
+
+   return 0;
+}
+
+static void* bench_thread_mutex_queue(void* p)
+{
+   bench_queue_thread* t = p;
+   const bench_node* nodes = t->data->nodes + t->first;
+   priority_queue* queue = t->data->queue;
+
+   for(size i = 0; i < t->count; ++i)
+   {
+      pthread_mutex_lock(t->mutex);
+      t->failed |= !priority_queue_insert(queue, nodes[i]);
+      if((i & 1) && !priority_queue_empty(queue))
+         t->sum += priority_queue_remove(queue).element, t->popped++;
+      pthread_mutex_unlock(t->mutex);
+   }
+   for(;;)
+   {
+      pthread_mutex_lock(t->mutex);
+      bool empty = priority_queue_empty(queue);
+      if(!empty)
+         t->sum += priority_queue_remove(queue).element, t->popped++;
+      pthread_mutex_unlock(t->mutex);
+
+      if(empty)
+         break;
+   }
+
+   return 0;
+}
+
+// sharded runs the multi queue, otherwise the mutex heap
+static void bench_queue_contention(bench_data* d, size iterations, void* (*function)(void*), bool sharded)
+{
+   pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+   pthread_t threads[BENCH_QUEUE_THREADS];
+   bench_queue_thread args[BENCH_QUEUE_THREADS];
+   const u32 thread_count = d->threads;
+   const size count = d->n/thread_count;
+   multi_queue multi;
+
+   // every value pushed has to come out exactly once
+   u64 expected = 0;
+   for(size i = 0; i < thread_count*count; ++i)
+      expected += d->nodes[i].element;
+
+   for(size k = 0; k < iterations; ++k)
+   {
+      arena_checkpoint mark = arena_mark(&d->storage);
+
+      // two shards per thread, each big enough for all the nodes of two threads
+      if(sharded && !multi_queue_init(&multi, &d->storage, 2*thread_count, (u32)(2*d->n/thread_count)))
+      {
+         fprintf(stderr, "bench: queue contention is out of memory for %u shards\n", 2*thread_count);
+         exit(1);
+      }
+      if(!sharded)
+         priority_queue_init(d->queue, 4);
+
+      for(u32 i = 0; i < thread_count; ++i)
+      {
+         args[i].data = d;
+         args[i].multi = &multi;
+         args[i].mutex = &mutex;
+         args[i].first = i*count;
+         args[i].count = count;
+         args[i].sum = 0;
+         args[i].popped = 0;
+         args[i].failed = false;
+         pthread_create(&threads[i], 0, function, &args[i]);
+      }
+
+      u64 sum = 0;
+      size popped = 0;
+      bool failed = false;
+      for(u32 i = 0; i < thread_count; ++i)
+      {
+         pthread_join(threads[i], 0);
+         sum += args[i].sum;
+         popped += args[i].popped;
+         failed |= args[i].failed;
+      }
+
+      // a thread may finish draining while another still pushes
+      multi_queue_entry entry;
+      while(sharded && multi_queue_pop(&multi, &entry))
+         sum += entry.value, popped++;
+      while(!sharded && !priority_queue_empty(d->queue))
+         sum += priority_queue_remove(d->queue).element, popped++;
+
+      if(failed || popped != thread_count*count || sum != expected)
+      {
+         fprintf(stderr, "bench: queue contention lost or duplicated entries\n");
+         exit(1);
+      }
+
+      arena_rewind(&d->storage, mark);
+   }
+}
+
+static void bench_queue_contention_multi(bench_data* d, size iterations)
+{
+   bench_queue_contention(d, iterations, bench_thread_multi_queue, true);
+}
+
+static void bench_queue_contention_mutex(bench_data* d, size iterations)
+{
+   bench_queue_contention(d, iterations, bench_thread_mutex_queue, false);
+}
+
+static void bench_arena_contention_atomic(bench_data* d, size iterations)
+{
+   bench_arena_contention(d, iterations, bench_thread_alloc_atomic);
+}
+
+static void bench_arena_contention_mutex(bench_data* d, size iterations)
+{
+   bench_arena_contention(d, iterations, bench_thread_alloc_mutex);
+}
+
+// n inserts of random keys then n removes, per element
+static void bench_queue_insert_remove(bench_data* d, size iterations)
+{
+   usize sum = 0;
+   for(size k = 0; k < iterations; ++k)
+   {
+      priority_queue_init(d->queue, d->arity);
+      for(size i = 0; i < d->n; ++i)
+         priority_queue_insert(d->queue, d->nodes[i]);
+      for(size i = 0; i < d->n; ++i)
+         sum += priority_queue_remove(d->queue).index;
+   }
+   bench_sink = (f32)sum;
+}
+
+static void bench_legacy_insert_remove(bench_data* d, size iterations)
+{
+   usize sum = 0;
+   for(size k = 0; k < iterations; ++k)
+   {
+      d->legacy->count = 0;
+      for(size i = 0; i < d->n; ++i)
+         legacy_queue_insert(d->legacy, d->nodes[i]);
+      for(size i = 0; i < d->n; ++i)
+         sum += legacy_queue_remove(d->legacy).index;
+   }
+   bench_sink = (f32)sum;
+}
+
+static void bench_queue_build_insert(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+   {
+      priority_queue_init(d->queue, d->arity);
+      for(size i = 0; i < d->n; ++i)
+         priority_queue_insert(d->queue, d->nodes[i]);
+   }
+   bench_sink = (f32)priority_queue_top(d->queue).index;
+}
+
+static void bench_queue_build_heapify(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+   {
+      priority_queue_init(d->queue, d->arity);
+      priority_queue_heapify(d->queue, d->nodes, d->n);
+   }
+   bench_sink = (f32)priority_queue_top(d->queue).index;
+}
+
+// Every key changes a little each frame, the queue alternates between the two key sets
+static void bench_queue_reprioritize_update(bench_data* d, size iterations)
+{
+   if(d->indexed.count != d->n)
+   {
+      indexed_queue_clear(&d->indexed);
+      for(size i = 0; i < d->n; ++i)
+         indexed_queue_insert(&d->indexed, (u32)i, d->nodes[i].index);
+   }
+
+   for(size k = 0; k < iterations; ++k)
+   {
+      const bench_node* frame = (k & 1) ? d->nodes : d->moved;
+      for(size i = 0; i < d->n; ++i)
+         indexed_queue_update_key(&d->indexed, (u32)i, frame[i].index);
+   }
+   bench_sink = (f32)indexed_queue_top(&d->indexed).key;
+}
+
+// Only every sixteenth handle moves per frame, the rest keep their keys
+static void bench_queue_reprioritize_sparse(bench_data* d, size iterations)
+{
+   if(d->indexed.count != d->n)
+   {
+      indexed_queue_clear(&d->indexed);
+      for(size i = 0; i < d->n; ++i)
+         indexed_queue_insert(&d->indexed, (u32)i, d->nodes[i].index);
+   }
+
+   for(size k = 0; k < iterations; ++k)
+   {
+      const bench_node* frame = (k & 16) ? d->nodes : d->moved;
+      for(size i = k & 15; i < d->n; i += 16)
+         indexed_queue_update_key(&d->indexed, (u32)i, frame[i].index);
+   }
+   bench_sink = (f32)indexed_queue_top(&d->indexed).key;
+}
+
+static void bench_queue_reprioritize_rebuild(bench_data* d, size iterations)
+{
+   priority_queue_init(d->queue, 4);
+   for(size k = 0; k < iterations; ++k)
+      priority_queue_heapify(d->queue, (k & 1) ? d->nodes : d->moved, d->n);
+   bench_sink = (f32)priority_queue_top(d->queue).index;
+}
+
+// Both sorts copy the unsorted keys in first, every iteration sorts the same input
+static void bench_sort_radix(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+   {
+      for(size i = 0; i < d->n; ++i)
+      {
+         d->sort_keys[i] = d->nodes[i].index;
+         d->sort_values[i] = d->nodes[i].element;
+      }
+      radix_sort_u64(d->sort_keys, d->sort_values, d->n, d->scratch);
+   }
+   bench_sink = (f32)d->sort_values[0];
+}
+
+static int bench_node_compare(const void* a, const void* b)
+{
+   usize x = ((const bench_node*)a)->index;
+   usize y = ((const bench_node*)b)->index;
+
+   return x < y ? -1 : x > y;
+}
+
+static void bench_sort_qsort(bench_data* d, size iterations)
+{
+   for(size k = 0; k < iterations; ++k)
+   {
+      memcpy(d->sort_nodes, d->nodes, d->n*sizeof(bench_node));
+      qsort(d->sort_nodes, d->n, sizeof(bench_node), bench_node_compare);
+   }
+   bench_sink = (f32)d->sort_nodes[0].element;
+}
+
+static bool bench_data_create(bench_data* d, arena* a)
+{
+   const size n = BENCH_MAX_COUNT;
+
+   d->ma = new(a, mat4, n);
+   d->mb = new(a, mat4, n);
+   d->mr = new(a, mat4, n);
+   d->v = new(a, vec4, n);
+   d->qa = new(a, quat, n);
+   d->qb = new(a, quat, n);
+   d->ta = new(a, trs, n);
+   d->tb = new(a, trs, n);
+   d->faces = new(a, f32, n*9);
+   d->x = new(a, f32, n);
+   d->y = new(a, f32, n);
+   d->z = new(a, f32, n);
+   d->r = new(a, f32, n);
+   d->ox = new(a, f32, n);
+   d->oy = new(a, f32, n);
+   d->oz = new(a, f32, n);
+   d->ow = new(a, f32, n);
+   d->visible = new(a, u32, n);
+   d->blocks = new(a, byte*, n);
+   d->fa = new(a, fp, n);
+   d->fb = new(a, fp, n);
+   d->fc = new(a, fp, n);
+   d->clip = new(a, vec4, n*3);
+   d->boxes = new(a, g_aabb, n);
+   d->queue = new(a, priority_queue);
+   d->legacy = new(a, legacy_queue);
+   d->nodes = new(a, bench_node, BENCH_QUEUE_MAX_COUNT);
+   d->moved = new(a, bench_node, BENCH_QUEUE_MAX_COUNT);
+   d->sort_keys = new(a, u64, BENCH_QUEUE_MAX_COUNT);
+   d->sort_values = new(a, u32, BENCH_QUEUE_MAX_COUNT);
+   d->sort_nodes = new(a, bench_node, BENCH_QUEUE_MAX_COUNT);
+   if(arena_end(a, d->sort_nodes) || !indexed_queue_init(&d->indexed, a, BENCH_QUEUE_MAX_COUNT, 4))
+      return false;
+
+   for(size i = 0; i < BENCH_QUEUE_MAX_COUNT; ++i)
+   {
+      d->nodes[i].index = ((usize)rand() << 16) ^ (usize)rand();
+      d->nodes[i].element = (u32)i;
+      d->moved[i] = d->nodes[i];
+      d->moved[i].index += (usize)(rand() % 4096);
+   }
+
+   for(size i = 0; i < n; ++i)
+   {
+      for(i32 j = 0; j < 16; ++j)
+         d->ma[i].data[j] = bench_random();
+      for(i32 j = 0; j < 4; ++j)
+         d->ma[i].data[j*5] += 4.0f;
+
+      vec3 axis = {{bench_random(), bench_random(), bench_random() + 2.0f}};
+      vec3_normalize(axis);
+      d->qa[i] = quat_from_axis_angle(axis, bench_random()*3.0f);
+      d->qb[i] = quat_from_axis_angle(axis, bench_random()*3.0f);
+
+      trs t = {d->qa[i], {{bench_random(), bench_random(), bench_random()}}, 1.5f};
+      d->ta[i] = t;
+      t.rotation = d->qb[i];
+      d->tb[i] = t;
+
+      d->mb[i] = trs_to_mat4(t);
+      d->v[i] = vec4_set(bench_random(), bench_random(), bench_random(), 1.0f);
+
+      for(i32 j = 0; j < 9; ++j)
+         d->faces[i*9 + j] = bench_random()*10.0f;
+
+      d->x[i] = bench_random()*200.0f;
+      d->y[i] = bench_random()*200.0f;
+      d->z[i] = bench_random()*200.0f;
+      d->r[i] = 1.0f + bench_random()*0.5f;
+
+      d->fa[i] = FP_to_fixed_point(bench_random()*100.0f, FP_Q16_16);
+      d->fb[i] = FP_to_fixed_point(bench_random()*100.0f, FP_Q16_16);
+
+      // a third of the triangles cross the screen edges or the near plane
+      for(i32 j = 0; j < 3; ++j)
+      {
+         f32 w = 1.0f + bench_random()*0.5f;
+         d->clip[i*3 + j] = vec4_set(bench_random()*1.5f*w, bench_random()*1.5f*w, (bench_random()*0.6f + 0.5f)*w, w);
+      }
+
+      vec3 c = {{d->x[i], d->y[i], d->z[i]}};
+      g_aabb box = {{{c.x - d->r[i], c.y - d->r[i], c.z - d->r[i]}}, {{c.x + d->r[i], c.y + d->r[i], c.z + d->r[i]}}};
+      d->boxes[i] = box;
+   }
+
+   g_frustum_create(&d->frustum, 800.0f, 600.0f, 90.0f, 0.1f, 150.0f);
+
+   vec3 p0 = {{0.0f, 0.0f, 0.0f}}, p1 = {{1.0f, 0.2f, 0.0f}}, p2 = {{0.0f, 0.3f, 1.0f}};
+   g_plane_create(&d->plane, &p0, &p1, &p2);
+
+   return true;
+}
+
+int main(int argc, char** argv)
+{
+   hw_virtual_memory_init();
+
+   if(argc > 1)
+      bench_filter = argv[1];
+
+   arena storage = arena_new_growable(GB(4), MB(64), 0);
+   bench_data data = {0};
+   data.scratch = arena_new(GB(1), 0);
+   data.storage = arena_new_growable(GB(1), MB(64), 0);
+   data.shared = arena_new(MB(64), 0);
+
+   if(!storage.header || !data.scratch.header || !data.storage.header || !data.shared.header || !bench_data_create(&data, &storage))
+   {
+      fprintf(stderr, "bench: out of memory\n");
+      return 1;
+   }
+
+   printf("kernel,variant,count,ns_per_item,items_per_second\n");
+
+   for(i32 s = 0; s < (i32)countof(bench_sizes); ++s)
+   {
+      const size n = bench_sizes[s];
+
+      bench_run("mat4_mul", BENCH_BACKEND, n, bench_mat4_mul, &data);
+      bench_run("vec4_transform", BENCH_BACKEND, n, bench_vec4_transform, &data);
+      bench_run("mat4_inverse", BENCH_BACKEND, n, bench_mat4_inverse, &data);
+      bench_run("mat4_inverse_affine", BENCH_BACKEND, n, bench_mat4_inverse_affine, &data);
+      bench_run("quat_mul", BENCH_BACKEND, n, bench_quat_mul, &data);
+      bench_run("quat_slerp", BENCH_BACKEND, n, bench_quat_slerp, &data);
+      bench_run("quat_to_mat4", BENCH_BACKEND, n, bench_quat_to_mat4, &data);
+      bench_run("trs_compose", "trs_mul", n, bench_trs_mul, &data);
+      bench_run("trs_compose", "mat4_mul", n, bench_trs_to_mat4_mul, &data);
+      bench_run("g_plane_classify_face_side", "scalar", n, bench_plane_classify_face, &data);
+      bench_run("g_plane_intersect_segment", "scalar", n, bench_plane_intersect_segment, &data);
+      bench_run("g_frustum_create", "scalar", n, bench_frustum_create, &data);
+      bench_run("g_frustum_from_matrix", "scalar", n, bench_frustum_from_matrix, &data);
+
+      bench_run("g_transform_soa", "scalar", n, bench_transform_soa_scalar, &data);
+      bench_run("g_frustum_cull_spheres", "scalar", n, bench_cull_spheres_scalar, &data);
+      bench_run("g_frustum_cull_aabbs", "scalar", n, bench_cull_aabbs_scalar, &data);
+#if defined(G_SIMD_SSE)
+      bench_run("g_transform_soa", "sse", n, bench_transform_soa_sse, &data);
+      bench_run("g_frustum_cull_spheres", "sse", n, bench_cull_spheres_sse, &data);
+      bench_run("g_frustum_cull_aabbs", "sse", n, bench_cull_aabbs_sse, &data);
+#endif
+#if defined(G_SIMD_AVX)
+      bench_run("g_transform_soa", "avx", n, bench_transform_soa_avx, &data);
+      bench_run("g_frustum_cull_spheres", "avx", n, bench_cull_spheres_avx, &data);
+      bench_run("g_frustum_cull_aabbs", "avx", n, bench_cull_aabbs_avx, &data);
+#endif
+
+      bench_run("fixed_mul", "scalar", n, bench_fixed_mul, &data);
+#if defined(FP_SIMD_SSE4)
+      bench_run("fixed_mul", "sse4", n, bench_fixed4_mul, &data);
+#endif
+
+      bench_run("g_clip_triangles", "scalar", n, bench_clip_triangles, &data);
+
+      {
+         arena scratch = data.scratch;
+         arena tree_storage = storage;
+         data.tree = bvh_build(&tree_storage, scratch, data.boxes, (u32)n);
+      }
+      bench_run("bvh_build", "sah", n, bench_bvh_build, &data);
+      bench_run("frustum_query", "bvh", n, bench_bvh_query_frustum, &data);
+      bench_run("frustum_query", "linear", n, bench_cull_aabbs_scalar, &data);
+
+      bench_run("arena_alloc", "alloc", n, bench_arena_alloc, &data);
+      bench_run("arena_alloc", "alloc_atomic", n, bench_arena_alloc_atomic, &data);
+      bench_run("arena_contention", "alloc_atomic", n, bench_arena_contention_atomic, &data);
+      bench_run("arena_contention", "mutex", n, bench_arena_contention_mutex, &data);
+   }
+
+   for(i32 s = 0; s < (i32)countof(bench_queue_sizes); ++s)
+   {
+      const size n = bench_queue_sizes[s];
+      const u32 arities[] = {2, 4, 8};
+      const char* names[] = {"arity2", "arity4", "arity8"};
+
+      bench_run("priority_queue_insert_remove", "legacy", n, bench_legacy_insert_remove, &data);
+      for(i32 i = 0; i < (i32)countof(arities); ++i)
+      {
+         data.arity = arities[i];
+         bench_run("priority_queue_insert_remove", names[i], n, bench_queue_insert_remove, &data);
+      }
+
+      for(i32 i = 0; i < (i32)countof(arities); ++i)
+      {
+         char variant[32];
+         data.arity = arities[i];
+
+         snprintf(variant, sizeof(variant), "%s_insert", names[i]);
+         bench_run("priority_queue_build", variant, n, bench_queue_build_insert, &data);
+         snprintf(variant, sizeof(variant), "%s_heapify", names[i]);
+         bench_run("priority_queue_build", variant, n, bench_queue_build_heapify, &data);
+      }
+
+      bench_run("queue_reprioritize", "indexed_update_key", n, bench_queue_reprioritize_update, &data);
+      bench_run("queue_reprioritize", "indexed_update_key_sixteenth", n, bench_queue_reprioritize_sparse, &data);
+      bench_run("queue_reprioritize", "heapify_rebuild", n, bench_queue_reprioritize_rebuild, &data);
+   }
+
+   for(i32 s = 0; s < (i32)countof(bench_sort_sizes); ++s)
+   {
+      bench_run("sort_u64", "radix", bench_sort_sizes[s], bench_sort_radix, &data);
+      bench_run("sort_u64", "qsort", bench_sort_sizes[s], bench_sort_qsort, &data);
+   }
+
+   for(u32 t = 1; t <= BENCH_QUEUE_THREADS; t *= 2)
+   {
+      char variant[32];
+      data.threads = t;
+
+      snprintf(variant, sizeof(variant), "multi_queue_%uthreads", t);
+      bench_run("queue_contention", variant, 256*1024, bench_queue_contention_multi, &data);
+      snprintf(variant, sizeof(variant), "mutex_heap_%uthreads", t);
+      bench_run("queue_contention", variant, 256*1024, bench_queue_contention_mutex, &data);
+   }
+
+   arena_free(&data.storage);
+   arena_free(&data.scratch);
+   arena_free(&data.shared);
+   arena_free(&storage);
+
+   return 0;
+}
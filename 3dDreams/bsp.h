@@ -0,0 +1,434 @@
+#if !defined(_BSP_H)
+#define _BSP_H
+
+#include "common.h"
+#include "arena.h"
+#include "graphics.h"
+
+// Binary space partition of a static triangle soup, built once at startup.
+// Faces are 9 floats, three xyz vertices. Every node splits by the plane of one face and keeps the
+// faces coplanar with it, faces crossing the plane are split. Nodes are stored depth first so the
+// front child of a node is the next node and the faces of a node are contiguous.
+
+#define bsp_null_index ((u32)-1)
+
+enum { BSP_SPLITTER_CANDIDATES = 8, BSP_SPLIT_COST = 8 };
+
+typedef struct bsp_node
+{
+   g_plane plane;
+   u32 front;
+   u32 back;
+   u32 first_face;
+   u32 face_count;
+} bsp_node;
+
+typedef struct bsp
+{
+   bsp_node* nodes;
+   f32* faces;
+   u32 node_count;
+   u32 face_count;
+} bsp;
+
+// pointer tree in the scratch arena, flattened once complete
+typedef struct bsp_build_node
+{
+   g_plane plane;
+   struct bsp_build_node* front;
+   struct bsp_build_node* back;
+   f32* faces;
+   u32 face_count;
+} bsp_build_node;
+
+typedef struct bsp_build_work
+{
+   struct bsp_build_work* next;
+   bsp_build_node** slot;
+   f32* faces;
+   u32 face_count;
+} bsp_build_work;
+
+static bool bsp_face_degenerate(const f32 face[9])
+{
+   vec3 ab = {{face[3] - face[0], face[4] - face[1], face[5] - face[2]}};
+   vec3 ac = {{face[6] - face[0], face[7] - face[1], face[8] - face[2]}};
+   vec3 n;
+
+   vec3_cross(ab, ac, n);
+
+   return vec3_len2(n) <= 0.0f;
+}
+
+static void bsp_face_plane(g_plane* plane, const f32 face[9])
+{
+   g_plane_create(plane, (const vec3*)face, (const vec3*)(face + 3), (const vec3*)(face + 6));
+}
+
+// Samples a few faces and picks the plane with the fewest splits and the best balance
+static u32 bsp_choose_splitter(const f32* faces, u32 count)
+{
+   u32 best = 0;
+   i64 best_score = INT64_MAX;
+   u32 step = count > BSP_SPLITTER_CANDIDATES ? count / BSP_SPLITTER_CANDIDATES : 1;
+
+   for(u32 c = 0; c < count; c += step)
+   {
+      g_plane plane;
+      bsp_face_plane(&plane, faces + c*9);
+
+      i64 front = 0, back = 0, split = 0;
+      for(u32 i = 0; i < count; ++i)
+      {
+         switch(g_plane_classify_face_side(&plane, (f32*)faces + i*9))
+         {
+         case G_PLANE_FRONT: ++front; break;
+         case G_PLANE_BACK: ++back; break;
+         default: ++split; break;
+         }
+      }
+
+      i64 score = BSP_SPLIT_COST*split + (front > back ? front - back : back - front);
+      if(score < best_score)
+      {
+         best_score = score;
+         best = c;
+      }
+   }
+
+   return best;
+}
+
+// Fans a convex polygon of up to four vertices into triangles, returns the triangle count
+static u32 bsp_emit_polygon(f32* out, const f32* polygon, i32 vertex_count)
+{
+   u32 count = 0;
+
+   for(i32 i = 1; i + 1 < vertex_count; ++i, ++count)
+   {
+      memcpy(out + count*9 + 0, polygon, 3*sizeof(f32));
+      memcpy(out + count*9 + 3, polygon + i*3, 3*sizeof(f32));
+      memcpy(out + count*9 + 6, polygon + (i + 1)*3, 3*sizeof(f32));
+   }
+
+   return count;
+}
+
+// Splits a face into polygons in front and in back of the plane, vertices on the plane go to both
+static void bsp_split_face(g_plane* plane, const f32 face[9], const i32 sides[3],
+                           f32 front[4*3], i32* front_count, f32 back[4*3], i32* back_count)
+{
+   *front_count = 0;
+   *back_count = 0;
+
+   for(i32 i = 0; i < 3; ++i)
+   {
+      i32 j = (i + 1) % 3;
+      f32* v0 = (f32*)face + i*3;
+      f32* v1 = (f32*)face + j*3;
+
+      if(sides[i] != G_PLANE_BACK)
+         memcpy(front + 3*(*front_count)++, v0, 3*sizeof(f32));
+      if(sides[i] != G_PLANE_FRONT)
+         memcpy(back + 3*(*back_count)++, v0, 3*sizeof(f32));
+
+      if((sides[i] == G_PLANE_FRONT && sides[j] == G_PLANE_BACK) ||
+         (sides[i] == G_PLANE_BACK && sides[j] == G_PLANE_FRONT))
+      {
+         f32 vi[3];
+         if(g_plane_intersect_segment(plane, v0, v1, vi))
+         {
+            memcpy(front + 3*(*front_count)++, vi, 3*sizeof(f32));
+            memcpy(back + 3*(*back_count)++, vi, 3*sizeof(f32));
+         }
+      }
+   }
+}
+
+// Classifies the vertices of a face, returns the counts in front and in back
+static void bsp_classify_face(g_plane* plane, const f32 face[9], i32 sides[3], i32* fn, i32* bn)
+{
+   *fn = *bn = 0;
+
+   for(i32 k = 0; k < 3; ++k)
+   {
+      sides[k] = g_plane_classify_vertex_side(plane, (f32*)face + k*3);
+      *fn += sides[k] == G_PLANE_FRONT;
+      *bn += sides[k] == G_PLANE_BACK;
+   }
+}
+
+// Triangles a split face leaves on one side, vertices on the plane and edge crossings are shared
+static u32 bsp_split_triangle_count(const i32 sides[3], i32 side)
+{
+   i32 vertices = 0;
+
+   for(i32 i = 0; i < 3; ++i)
+   {
+      i32 j = (i + 1) % 3;
+      vertices += sides[i] == side || sides[i] == G_PLANE_ON;
+      vertices += (sides[i] == G_PLANE_FRONT && sides[j] == G_PLANE_BACK) || (sides[i] == G_PLANE_BACK && sides[j] == G_PLANE_FRONT);
+   }
+
+   return vertices > 2 ? (u32)vertices - 2 : 0;
+}
+
+// Builds the node of one work item and queues its front and back lists.
+// Without split faces the larger list is compacted in place over the input, the input is dead after
+// the partition, so a convex mesh that degenerates into a list builds in linear memory.
+static bool bsp_build_node_create(arena* scratch, bsp_build_work* work, bsp_build_work** stack, u32* face_total)
+{
+   const u32 count = work->face_count;
+   f32* faces = work->faces;
+
+   bsp_build_node* node = new(scratch, bsp_build_node);
+   if(arena_end(scratch, node))
+      return false;
+
+   u32 splitter = bsp_choose_splitter(faces, count);
+   bsp_face_plane(&node->plane, faces + splitter*9);
+
+   // count first so every list is allocated exactly
+   u32 on_count = 0, front_count = 0, back_count = 0, split_count = 0;
+   for(u32 i = 0; i < count; ++i)
+   {
+      i32 sides[3], fn, bn;
+      bsp_classify_face(&node->plane, faces + i*9, sides, &fn, &bn);
+
+      if(i == splitter || (fn == 0 && bn == 0))
+         on_count++;
+      else if(bn == 0)
+         front_count++;
+      else if(fn == 0)
+         back_count++;
+      else
+      {
+         front_count += bsp_split_triangle_count(sides, G_PLANE_FRONT);
+         back_count += bsp_split_triangle_count(sides, G_PLANE_BACK);
+         split_count++;
+      }
+   }
+
+   bool front_in_place = split_count == 0 && front_count >= back_count;
+   bool back_in_place = split_count == 0 && !front_in_place;
+
+   // empty lists stay null, the splitter is always on the node
+   f32* on = new(scratch, f32, on_count*9);
+   f32* front = front_in_place ? faces : front_count > 0 ? new(scratch, f32, front_count*9) : 0;
+   f32* back = back_in_place ? faces : back_count > 0 ? new(scratch, f32, back_count*9) : 0;
+   if(arena_end(scratch, on) || arena_end(scratch, front) || arena_end(scratch, back))
+      return false;
+
+   // in place writes never pass the face being read
+   u32 on_written = 0, front_written = 0, back_written = 0;
+   for(u32 i = 0; i < count; ++i)
+   {
+      f32 face[9];
+      memcpy(face, faces + i*9, sizeof(face));
+
+      i32 sides[3], fn, bn;
+      bsp_classify_face(&node->plane, face, sides, &fn, &bn);
+
+      if(i == splitter || (fn == 0 && bn == 0))
+      {
+         memcpy(on + on_written++*9, face, sizeof(face));
+      }
+      else if(bn == 0)
+      {
+         memcpy(front + front_written++*9, face, sizeof(face));
+      }
+      else if(fn == 0)
+      {
+         memcpy(back + back_written++*9, face, sizeof(face));
+      }
+      else
+      {
+         f32 front_polygon[4*3], back_polygon[4*3];
+         i32 front_vertices, back_vertices;
+
+         bsp_split_face(&node->plane, face, sides, front_polygon, &front_vertices, back_polygon, &back_vertices);
+
+         front_written += bsp_emit_polygon(front + front_written*9, front_polygon, front_vertices);
+         back_written += bsp_emit_polygon(back + back_written*9, back_polygon, back_vertices);
+      }
+   }
+
+   // a failed intersection emits less than counted, never more
+   post(on_written == on_count && front_written <= front_count && back_written <= back_count);
+
+   node->front = node->back = 0;
+   node->faces = on;
+   node->face_count = on_count;
+   *work->slot = node;
+   *face_total += on_count;
+
+   bsp_build_node** slots[2] = {&node->back, &node->front};
+   f32* lists[2] = {back, front};
+   u32 counts[2] = {back_written, front_written};
+
+   for(i32 k = 0; k < 2; ++k)
+   {
+      if(counts[k] == 0)
+         continue;
+
+      bsp_build_work* child = new(scratch, bsp_build_work);
+      if(arena_end(scratch, child))
+         return false;
+
+      child->slot = slots[k];
+      child->faces = lists[k];
+      child->face_count = counts[k];
+      child->next = *stack;
+      *stack = child;
+   }
+
+   return true;
+}
+
+// Builds the tree into the arena, the scratch arena holds the intermediate face lists.
+// Degenerate faces are dropped. Returns an empty tree if either arena runs out.
+static bsp bsp_build(arena* a, arena scratch, const f32* faces, u32 face_count)
+{
+   bsp result = {0};
+
+   f32* input = new(&scratch, f32, face_count*9);
+   if(arena_end(&scratch, input))
+      return result;
+
+   u32 count = 0;
+   for(u32 i = 0; i < face_count; ++i)
+      if(!bsp_face_degenerate(faces + i*9))
+         memcpy(input + count++*9, faces + i*9, 9*sizeof(f32));
+
+   if(count == 0)
+      return result;
+
+   // iterative, the tree of a convex mesh degenerates to a list as deep as its face count
+   bsp_build_node* root = 0;
+   bsp_build_work* stack = new(&scratch, bsp_build_work);
+   if(arena_end(&scratch, stack))
+      return result;
+
+   stack->next = 0;
+   stack->slot = &root;
+   stack->faces = input;
+   stack->face_count = count;
+
+   u32 node_total = 0, face_total = 0;
+   while(stack)
+   {
+      bsp_build_work* work = stack;
+      stack = stack->next;
+
+      if(!bsp_build_node_create(&scratch, work, &stack, &face_total))
+         return result;
+      node_total++;
+   }
+
+   bsp_node* nodes = new(a, bsp_node, node_total);
+   f32* out_faces = new(a, f32, face_total*9);
+   bsp_build_node** pending = new(&scratch, bsp_build_node*, node_total);
+   u32* parents = new(&scratch, u32, node_total);
+   if(arena_end(a, nodes) || arena_end(a, out_faces) || arena_end(&scratch, pending) || arena_end(&scratch, parents))
+      return result;
+
+   // flatten depth first with the front child pushed last so it comes right after its parent
+   u32 top = 0;
+   pending[top] = root;
+   parents[top++] = bsp_null_index;
+
+   while(top > 0)
+   {
+      --top;
+      bsp_build_node* node = pending[top];
+      u32 parent = parents[top];
+
+      u32 index = result.node_count++;
+      bsp_node* out = nodes + index;
+
+      out->plane = node->plane;
+      out->front = out->back = bsp_null_index;
+      out->first_face = result.face_count;
+      out->face_count = node->face_count;
+
+      memcpy(out_faces + result.face_count*9, node->faces, node->face_count*9*sizeof(f32));
+      result.face_count += node->face_count;
+
+      // the low bit of the parent tells which child this is
+      if(parent != bsp_null_index)
+      {
+         if(parent & 1)
+            nodes[parent >> 1].front = index;
+         else
+            nodes[parent >> 1].back = index;
+      }
+
+      if(node->back)
+      {
+         pending[top] = node->back;
+         parents[top++] = index << 1;
+      }
+      if(node->front)
+      {
+         pending[top] = node->front;
+         parents[top++] = index << 1 | 1;
+      }
+   }
+
+   post(result.node_count == node_total && result.face_count == face_total);
+
+   result.nodes = nodes;
+   result.faces = out_faces;
+
+   return result;
+}
+
+// Writes the face indexes ordered front to back as seen from eye, returns the count written.
+// Faces behind a plane never occlude faces in front of it, so drawing in this order with a
+// coverage mask touches every pixel once.
+static u32 bsp_traverse_front_to_back(const bsp* tree, vec3 eye, arena scratch, u32* order)
+{
+   if(tree->node_count == 0)
+      return 0;
+
+   // node indexes with the top bit marking a node whose faces are due
+   const u32 emit = 1u << 31;
+   u32* stack = new(&scratch, u32, 2*tree->node_count + 1);
+   if(arena_end(&scratch, stack))
+      return 0;
+
+   u32 count = 0, top = 0;
+   stack[top++] = 0;
+
+   while(top > 0)
+   {
+      u32 entry = stack[--top];
+
+      if(entry & emit)
+      {
+         const bsp_node* node = tree->nodes + (entry & ~emit);
+         for(u32 i = 0; i < node->face_count; ++i)
+            order[count++] = node->first_face + i;
+         continue;
+      }
+
+      const bsp_node* node = tree->nodes + entry;
+      bool in_back = g_plane_classify_vertex_side((g_plane*)&node->plane, eye.data) == G_PLANE_BACK;
+
+      u32 near_child = in_back ? node->back : node->front;
+      u32 far_child = in_back ? node->front : node->back;
+
+      // popped in reverse, near side first
+      if(far_child != bsp_null_index)
+         stack[top++] = far_child;
+      stack[top++] = entry | emit;
+      if(near_child != bsp_null_index)
+         stack[top++] = near_child;
+   }
+
+   post(count == tree->face_count);
+
+   return count;
+}
+
+#endif
@@ -0,0 +1,123 @@
+#if !defined(_BUCKET_QUEUE_H)
+#define _BUCKET_QUEUE_H
+
+#include "common.h"
+#include "arena.h"
+
+// Monotone bucket queue of u32 handles with integer keys, the key popped never goes down.
+// Buckets are intrusive lists through the handles and wrap around, so keys may grow without
+// bound as long as every queued key is less than bucket_count past the last popped one.
+// Insert and update are O(1), pop is O(1) amortized over the key range walked.
+
+#define bucket_queue_null ((u32)-1)
+
+#define bucket_queue_empty(q) ((q)->count == 0)
+
+typedef struct bucket_queue
+{
+   u32* head;        // first handle of every bucket
+   u32* next;        // next handle in the same bucket
+   u32* prev;        // previous handle, for removal from the middle of a bucket
+   u32* key;         // key of every queued handle
+   u32 bucket_mask;  // bucket_count - 1
+   u32 handle_count;
+   u32 cursor;       // smallest key that can still be queued
+   u32 count;
+} bucket_queue;
+
+// Handles run from 0 to handle_count - 1, bucket_count is a power of two. False when the arena is out of memory
+static bool bucket_queue_init(bucket_queue* queue, arena* a, u32 handle_count, u32 bucket_count)
+{
+   pre(bucket_count > 0 && (bucket_count & (bucket_count - 1)) == 0);
+   pre(handle_count > 0 && handle_count < bucket_queue_null);
+
+   queue->head = new(a, u32, bucket_count);
+   queue->next = new(a, u32, handle_count);
+   queue->prev = new(a, u32, handle_count);
+   queue->key = new(a, u32, handle_count);
+   if(arena_end(a, queue->head) || arena_end(a, queue->next) || arena_end(a, queue->prev) || arena_end(a, queue->key))
+      return false;
+
+   memset(queue->head, 0xff, bucket_count*sizeof(u32));
+   memset(queue->prev, 0xff, handle_count*sizeof(u32));
+
+   queue->bucket_mask = bucket_count - 1;
+   queue->handle_count = handle_count;
+   queue->cursor = 0;
+   queue->count = 0;
+
+   return true;
+}
+
+// prev of a queued handle is either another handle or the bucket marker, never null
+#define bucket_queue_marker(q) ((q)->handle_count)
+#define bucket_queue_contains(q, h) ((q)->prev[(h)] != bucket_queue_null)
+
+static void bucket_queue_insert(bucket_queue* queue, u32 handle, u32 key)
+{
+   pre(handle < queue->handle_count && !bucket_queue_contains(queue, handle));
+   pre(key >= queue->cursor && key - queue->cursor <= queue->bucket_mask);
+
+   u32* head = &queue->head[key & queue->bucket_mask];
+
+   queue->key[handle] = key;
+   queue->next[handle] = *head;
+   queue->prev[handle] = bucket_queue_marker(queue);
+   if(*head != bucket_queue_null)
+      queue->prev[*head] = handle;
+   *head = handle;
+
+   queue->count++;
+}
+
+// False when the handle was not queued
+static bool bucket_queue_remove(bucket_queue* queue, u32 handle)
+{
+   pre(handle < queue->handle_count);
+
+   if(!bucket_queue_contains(queue, handle))
+      return false;
+
+   u32 next = queue->next[handle];
+   u32 prev = queue->prev[handle];
+
+   if(prev == bucket_queue_marker(queue))
+      queue->head[queue->key[handle] & queue->bucket_mask] = next;
+   else
+      queue->next[prev] = next;
+
+   if(next != bucket_queue_null)
+      queue->prev[next] = prev;
+
+   queue->prev[handle] = bucket_queue_null;
+   queue->count--;
+
+   return true;
+}
+
+// Moves a queued handle to another key or inserts it
+static void bucket_queue_update_key(bucket_queue* queue, u32 handle, u32 key)
+{
+   bucket_queue_remove(queue, handle);
+   bucket_queue_insert(queue, handle, key);
+}
+
+// A handle with the smallest key, handles of equal key come out last in first out
+static u32 bucket_queue_pop(bucket_queue* queue, u32* key)
+{
+   pre(queue->count > 0);
+
+   while(queue->head[queue->cursor & queue->bucket_mask] == bucket_queue_null)
+      queue->cursor++;
+
+   u32 handle = queue->head[queue->cursor & queue->bucket_mask];
+   post(queue->key[handle] == queue->cursor);
+
+   bucket_queue_remove(queue, handle);
+   if(key)
+      *key = queue->cursor;
+
+   return handle;
+}
+
+#endif
@@ -0,0 +1,427 @@
+#if !defined(_BVH_H)
+#define _BVH_H
+
+#include <float.h>
+#include "common.h"
+#include "arena.h"
+#include "graphics.h"
+
+// Bounding volume hierarchy over object boxes, built top down with a binned surface area heuristic.
+// Nodes live in one flat array, the root is node 0 and siblings are adjacent pairs starting at an
+// even index so a pair shares a cache line. Leaves reference a range of the index array.
+// The build splits into independent subtrees, a job system can hand out the work items as they are pushed.
+
+#define bvh_null_index ((u32)-1)
+
+enum { BVH_BIN_COUNT = 16, BVH_LEAF_MAX = 8 };
+
+// cost of visiting an inner node relative to testing one object
+#define BVH_TRAVERSAL_COST 1.0f
+
+typedef struct bvh_node
+{
+   g_aabb box;
+   u32 first;     // left child for inner nodes, first index for leaves
+   u32 count;     // zero for inner nodes
+} bvh_node;
+
+typedef struct bvh
+{
+   bvh_node* nodes;
+   u32* indexes;
+   u32 node_count;
+   u32 count;
+   u32 depth;
+} bvh;
+
+// plain compares compile to single min and max instructions, fminf is a call without fast math
+#define bvh_min(a, b) ((a) < (b) ? (a) : (b))
+#define bvh_max(a, b) ((a) > (b) ? (a) : (b))
+
+static inline g_aabb bvh_aabb_empty()
+{
+   g_aabb result = {{{FLT_MAX, FLT_MAX, FLT_MAX}}, {{-FLT_MAX, -FLT_MAX, -FLT_MAX}}};
+   return result;
+}
+
+static inline void bvh_aabb_grow(g_aabb* a, const g_aabb* b)
+{
+   for(i32 i = 0; i < 3; ++i)
+   {
+      a->min.data[i] = bvh_min(a->min.data[i], b->min.data[i]);
+      a->max.data[i] = bvh_max(a->max.data[i], b->max.data[i]);
+   }
+}
+
+static inline void bvh_aabb_grow_point(g_aabb* a, const vec3* p)
+{
+   for(i32 i = 0; i < 3; ++i)
+   {
+      a->min.data[i] = bvh_min(a->min.data[i], p->data[i]);
+      a->max.data[i] = bvh_max(a->max.data[i], p->data[i]);
+   }
+}
+
+// Half the surface area, the heuristic only compares ratios
+static inline f32 bvh_aabb_area(const g_aabb* a)
+{
+   f32 dx = a->max.x - a->min.x, dy = a->max.y - a->min.y, dz = a->max.z - a->min.z;
+   return (dx < 0.0f) ? 0.0f : dx*dy + dy*dz + dz*dx;
+}
+
+static void bvh_node_bounds(bvh* tree, bvh_node* node, const g_aabb* boxes)
+{
+   node->box = bvh_aabb_empty();
+   for(u32 i = 0; i < node->count; ++i)
+      bvh_aabb_grow(&node->box, boxes + tree->indexes[node->first + i]);
+}
+
+// Binned sweep over all three axes, returns the cost of the best split or FLT_MAX without one
+static f32 bvh_find_split(const bvh* tree, const bvh_node* node, const g_aabb* boxes, const vec3* centroids, i32* best_axis, f32* best_plane)
+{
+   g_aabb bounds = bvh_aabb_empty();
+   for(u32 i = 0; i < node->count; ++i)
+      bvh_aabb_grow_point(&bounds, centroids + tree->indexes[node->first + i]);
+
+   f32 best_cost = FLT_MAX;
+
+   for(i32 axis = 0; axis < 3; ++axis)
+   {
+      f32 lo = bounds.min.data[axis], hi = bounds.max.data[axis];
+      if(lo == hi)
+         continue;
+
+      g_aabb bin_boxes[BVH_BIN_COUNT];
+      u32 bin_counts[BVH_BIN_COUNT] = {0};
+      for(i32 b = 0; b < BVH_BIN_COUNT; ++b)
+         bin_boxes[b] = bvh_aabb_empty();
+
+      const f32 scale = BVH_BIN_COUNT / (hi - lo);
+      for(u32 i = 0; i < node->count; ++i)
+      {
+         u32 index = tree->indexes[node->first + i];
+         i32 b = (i32)((centroids[index].data[axis] - lo)*scale);
+         b = b < BVH_BIN_COUNT ? b : BVH_BIN_COUNT - 1;
+
+         bin_counts[b]++;
+         bvh_aabb_grow(&bin_boxes[b], boxes + index);
+      }
+
+      // sweep the bins from both sides, a split between bins b - 1 and b costs count*area of each side
+      f32 left_area[BVH_BIN_COUNT - 1];
+      u32 left_count[BVH_BIN_COUNT - 1];
+      g_aabb left = bvh_aabb_empty();
+      u32 left_sum = 0;
+      for(i32 b = 0; b < BVH_BIN_COUNT - 1; ++b)
+      {
+         left_sum += bin_counts[b];
+         bvh_aabb_grow(&left, &bin_boxes[b]);
+         left_count[b] = left_sum;
+         left_area[b] = bvh_aabb_area(&left);
+      }
+
+      g_aabb right = bvh_aabb_empty();
+      u32 right_sum = 0;
+      for(i32 b = BVH_BIN_COUNT - 1; b > 0; --b)
+      {
+         right_sum += bin_counts[b];
+         bvh_aabb_grow(&right, &bin_boxes[b]);
+
+         if(left_count[b - 1] == 0 || right_sum == 0)
+            continue;
+
+         f32 cost = left_count[b - 1]*left_area[b - 1] + right_sum*bvh_aabb_area(&right);
+         if(cost < best_cost)
+         {
+            best_cost = cost;
+            *best_axis = axis;
+            *best_plane = lo + b/scale;
+         }
+      }
+   }
+
+   return best_cost;
+}
+
+// Builds over count boxes, the tree and its index array come from the arena and the scratch
+// arena holds the centroids and the work stack. Returns an empty tree if either runs out.
+static bvh bvh_build(arena* a, arena scratch, const g_aabb* boxes, u32 count)
+{
+   bvh result = {0};
+   if(count == 0)
+      return result;
+
+   u32* indexes = new(a, u32, count);
+   // a binary tree with count leaves has 2*count - 1 nodes, plus the unused slot after the root
+   bvh_node* nodes = alloc(a, sizeof(bvh_node), 64, 2*count, 0);
+   vec3* centroids = new(&scratch, vec3, count);
+   u32* stack = new(&scratch, u32, 2*count);
+   u32* depths = new(&scratch, u32, 2*count);
+   if(arena_end(a, indexes) || arena_end(a, nodes) || arena_end(&scratch, centroids) || arena_end(&scratch, stack) || arena_end(&scratch, depths))
+      return result;
+
+   for(u32 i = 0; i < count; ++i)
+   {
+      indexes[i] = i;
+      for(i32 k = 0; k < 3; ++k)
+         centroids[i].data[k] = (boxes[i].min.data[k] + boxes[i].max.data[k])*0.5f;
+   }
+
+   result.nodes = nodes;
+   result.indexes = indexes;
+   result.count = count;
+   result.node_count = 2;
+
+   nodes[0].first = 0;
+   nodes[0].count = count;
+   bvh_node_bounds(&result, &nodes[0], boxes);
+
+   u32 top = 0;
+   stack[top] = 0;
+   depths[top++] = 1;
+
+   while(top > 0)
+   {
+      --top;
+      bvh_node* node = nodes + stack[top];
+      u32 depth = depths[top];
+
+      result.depth = depth > result.depth ? depth : result.depth;
+
+      if(node->count <= 1)
+         continue;
+
+      i32 axis = 0;
+      f32 plane = 0.0f;
+      f32 split_cost = bvh_find_split(&result, node, boxes, centroids, &axis, &plane);
+      f32 area = bvh_aabb_area(&node->box);
+      f32 leaf_cost = node->count*area;
+
+      if(split_cost + BVH_TRAVERSAL_COST*area >= leaf_cost && node->count <= BVH_LEAF_MAX)
+         continue;
+
+      u32 first = node->first, last = node->first + node->count;
+      u32 mid = first;
+
+      if(split_cost < FLT_MAX)
+      {
+         // partition in place around the split plane
+         u32 j = last;
+         while(mid < j)
+         {
+            if(centroids[indexes[mid]].data[axis] < plane)
+               mid++;
+            else
+            {
+               u32 t = indexes[mid];
+               indexes[mid] = indexes[--j];
+               indexes[j] = t;
+            }
+         }
+      }
+
+      // coincident centroids or rounding at the bin edge, halve the range to keep leaves small
+      if(mid == first || mid == last)
+         mid = first + node->count/2;
+
+      u32 left = result.node_count;
+      result.node_count += 2;
+
+      nodes[left].first = first;
+      nodes[left].count = mid - first;
+      nodes[left + 1].first = mid;
+      nodes[left + 1].count = last - mid;
+      bvh_node_bounds(&result, &nodes[left], boxes);
+      bvh_node_bounds(&result, &nodes[left + 1], boxes);
+
+      node->first = left;
+      node->count = 0;
+
+      stack[top] = left;
+      depths[top++] = depth + 1;
+      stack[top] = left + 1;
+      depths[top++] = depth + 1;
+   }
+
+   post(result.node_count <= 2*count);
+
+   // hand back the nodes never used
+   if(a->beg == (byte*)(nodes + 2*count))
+      arena_shrink_to(a, nodes, result.node_count*sizeof(bvh_node));
+
+   return result;
+}
+
+// Updates the boxes after the objects moved, the topology is kept so the quality degrades
+// with large motion and a rebuild is due now and then. Children come after their parent
+// so a reverse sweep sees every child first.
+static void bvh_refit(bvh* tree, const g_aabb* boxes)
+{
+   for(u32 i = tree->node_count; i-- > 0;)
+   {
+      bvh_node* node = tree->nodes + i;
+      if(i == 1)
+         continue;
+
+      if(node->count > 0)
+      {
+         bvh_node_bounds(tree, node, boxes);
+      }
+      else
+      {
+         node->box = tree->nodes[node->first].box;
+         bvh_aabb_grow(&node->box, &tree->nodes[node->first + 1].box);
+      }
+   }
+}
+
+// Plane bits still to test for a box, clears the planes the box is fully inside of.
+// Returns false if the box is fully outside of one.
+static bool bvh_frustum_test(const g_plane* planes, const g_aabb* box, u32* mask)
+{
+   vec3 c = {{(box->min.x + box->max.x)*0.5f, (box->min.y + box->max.y)*0.5f, (box->min.z + box->max.z)*0.5f}};
+   vec3 e = {{(box->max.x - box->min.x)*0.5f, (box->max.y - box->min.y)*0.5f, (box->max.z - box->min.z)*0.5f}};
+
+   for(i32 j = 0; j < G_FRUSTUM_PLANE_COUNT; ++j)
+   {
+      if(!(*mask & (1u << j)))
+         continue;
+
+      const g_plane* p = planes + j;
+      f32 dist = p->n.x*c.x + p->n.y*c.y + p->n.z*c.z + p->d;
+      f32 radius = fabsf(p->n.x)*e.x + fabsf(p->n.y)*e.y + fabsf(p->n.z)*e.z;
+
+      if(dist > radius)
+         return false;
+      if(dist <= -radius)
+         *mask &= ~(1u << j);
+   }
+
+   return true;
+}
+
+// Writes the indexes of the objects whose boxes are not outside the frustum, returns the count.
+// Subtrees fully inside skip every test below them.
+static u32 bvh_query_frustum(const bvh* tree, const g_aabb* boxes, const g_frustum* frustum, arena scratch, u32* visible)
+{
+   if(tree->node_count == 0)
+      return 0;
+
+   const g_plane* planes = g_frustum_planes(frustum);
+   u32* stack = new(&scratch, u32, 2*(tree->depth + 1));
+   if(arena_end(&scratch, stack))
+      return 0;
+
+   u32 count = 0, top = 0;
+   stack[top++] = 0;
+   stack[top++] = (1u << G_FRUSTUM_PLANE_COUNT) - 1;
+
+   while(top > 0)
+   {
+      u32 mask = stack[--top];
+      const bvh_node* node = tree->nodes + stack[--top];
+
+      if(mask && !bvh_frustum_test(planes, &node->box, &mask))
+         continue;
+
+      if(node->count == 0)
+      {
+         stack[top++] = node->first;
+         stack[top++] = mask;
+         stack[top++] = node->first + 1;
+         stack[top++] = mask;
+         continue;
+      }
+
+      for(u32 i = 0; i < node->count; ++i)
+      {
+         u32 index = tree->indexes[node->first + i];
+         u32 object_mask = mask;
+
+         if(!object_mask || bvh_frustum_test(planes, boxes + index, &object_mask))
+            visible[count++] = index;
+      }
+   }
+
+   return count;
+}
+
+// Slab test, returns the entry distance or FLT_MAX on a miss
+static inline f32 bvh_ray_box(const g_aabb* box, vec3 origin, vec3 inv_dir, f32 tmax)
+{
+   f32 tx0 = (box->min.x - origin.x)*inv_dir.x, tx1 = (box->max.x - origin.x)*inv_dir.x;
+   f32 ty0 = (box->min.y - origin.y)*inv_dir.y, ty1 = (box->max.y - origin.y)*inv_dir.y;
+   f32 tz0 = (box->min.z - origin.z)*inv_dir.z, tz1 = (box->max.z - origin.z)*inv_dir.z;
+
+   f32 enter = bvh_max(bvh_max(bvh_min(tx0, tx1), bvh_min(ty0, ty1)), bvh_max(bvh_min(tz0, tz1), 0.0f));
+   f32 leave = bvh_min(bvh_min(bvh_max(tx0, tx1), bvh_max(ty0, ty1)), bvh_min(bvh_max(tz0, tz1), tmax));
+
+   return enter <= leave ? enter : FLT_MAX;
+}
+
+// Nearest object box hit by the ray within tmax, the nearer child is visited first and
+// subtrees beyond the current hit are skipped. Writes the distance, returns bvh_null_index on a miss.
+static u32 bvh_query_ray(const bvh* tree, const g_aabb* boxes, vec3 origin, vec3 dir, f32 tmax, arena scratch, f32* t)
+{
+   u32 result = bvh_null_index;
+   if(tree->node_count == 0)
+      return result;
+
+   u32* stack = new(&scratch, u32, tree->depth + 1);
+   if(arena_end(&scratch, stack))
+      return result;
+
+   vec3 inv_dir = {{1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z}};
+   f32 nearest = tmax;
+
+   u32 top = 0;
+   if(bvh_ray_box(&tree->nodes[0].box, origin, inv_dir, nearest) != FLT_MAX)
+      stack[top++] = 0;
+
+   while(top > 0)
+   {
+      const bvh_node* node = tree->nodes + stack[--top];
+
+      // a closer hit was found since the node was pushed
+      if(bvh_ray_box(&node->box, origin, inv_dir, nearest) == FLT_MAX)
+         continue;
+
+      if(node->count > 0)
+      {
+         for(u32 i = 0; i < node->count; ++i)
+         {
+            u32 index = tree->indexes[node->first + i];
+            f32 hit = bvh_ray_box(boxes + index, origin, inv_dir, nearest);
+            if(hit != FLT_MAX && (hit < nearest || result == bvh_null_index))
+            {
+               nearest = hit;
+               result = index;
+            }
+         }
+         continue;
+      }
+
+      u32 a = node->first, b = node->first + 1;
+      f32 ta = bvh_ray_box(&tree->nodes[a].box, origin, inv_dir, nearest);
+      f32 tb = bvh_ray_box(&tree->nodes[b].box, origin, inv_dir, nearest);
+
+      if(tb < ta)
+      {
+         u32 s = a; a = b; b = s;
+         f32 st = ta; ta = tb; tb = st;
+      }
+
+      // far first so the near child is popped next
+      if(tb != FLT_MAX)
+         stack[top++] = b;
+      if(ta != FLT_MAX)
+         stack[top++] = a;
+   }
+
+   if(t)
+      *t = nearest;
+
+   return result;
+}
+
+#endif
@@ -0,0 +1,173 @@
+#if !defined(_CLIP_H)
+#define _CLIP_H
+
+#include "common.h"
+#include "arena.h"
+#include "graphics.h"
+
+// Sutherland-Hodgman clipping of clip space triangles, 0 <= z <= w depth.
+// x and y are only clipped against a guard band of guard*w, the rasterizer scissors the rest,
+// so most triangles crossing the screen edges pass through untouched. Near and far are always clipped.
+
+enum
+{
+   G_CLIP_LEFT    = 1 << 0,
+   G_CLIP_RIGHT   = 1 << 1,
+   G_CLIP_BOTTOM  = 1 << 2,
+   G_CLIP_TOP     = 1 << 3,
+   G_CLIP_NEAR    = 1 << 4,
+   G_CLIP_FAR     = 1 << 5,
+   G_CLIP_PLANE_COUNT = 6,
+
+   // every plane adds at most one vertex
+   G_CLIP_MAX_VERTICES = 3 + G_CLIP_PLANE_COUNT,
+   G_CLIP_MAX_TRIANGLES = G_CLIP_MAX_VERTICES - 2,
+};
+
+// Triangles as three consecutive vertices each
+typedef struct g_clip_result
+{
+   vec4* vertices;
+   size count;
+} g_clip_result;
+
+// Outside bits against the planes at distance limit*w
+static u32 g_clip_outcode(vec4 v, f32 limit)
+{
+   f32 w = v.w*limit;
+   u32 code = 0;
+
+   code |= (v.x < -w) ? G_CLIP_LEFT : 0;
+   code |= (v.x > w) ? G_CLIP_RIGHT : 0;
+   code |= (v.y < -w) ? G_CLIP_BOTTOM : 0;
+   code |= (v.y > w) ? G_CLIP_TOP : 0;
+   code |= (v.z < 0.0f) ? G_CLIP_NEAR : 0;
+   code |= (v.z > v.w) ? G_CLIP_FAR : 0;
+
+   return code;
+}
+
+// Signed distance to a clip plane, inside is positive
+static f32 g_clip_distance(vec4 v, i32 plane, f32 guard)
+{
+   switch(plane)
+   {
+   case 0: return v.x + guard*v.w;
+   case 1: return guard*v.w - v.x;
+   case 2: return v.y + guard*v.w;
+   case 3: return guard*v.w - v.y;
+   case 4: return v.z;
+   default: return v.w - v.z;
+   }
+}
+
+// Clips the polygon in place against the planes in mask, returns the new vertex count
+static i32 g_clip_polygon(vec4 polygon[G_CLIP_MAX_VERTICES], i32 count, u32 mask, f32 guard)
+{
+   vec4 scratch[G_CLIP_MAX_VERTICES];
+   vec4* in = polygon;
+   vec4* out = scratch;
+
+   for(i32 plane = 0; plane < G_CLIP_PLANE_COUNT && count >= 3; ++plane)
+   {
+      if(!(mask & (1u << plane)))
+         continue;
+
+      i32 out_count = 0;
+      vec4 v0 = in[count - 1];
+      f32 d0 = g_clip_distance(v0, plane, guard);
+
+      for(i32 i = 0; i < count; ++i)
+      {
+         vec4 v1 = in[i];
+         f32 d1 = g_clip_distance(v1, plane, guard);
+
+         // edge crosses the plane
+         if((d0 >= 0.0f) != (d1 >= 0.0f))
+            out[out_count++] = vec4_add(v0, vec4_scale(vec4_sub(v1, v0), d0 / (d0 - d1)));
+
+         if(d1 >= 0.0f)
+            out[out_count++] = v1;
+
+         v0 = v1;
+         d0 = d1;
+      }
+
+      vec4* t = in; in = out; out = t;
+      count = out_count;
+   }
+
+   if(in != polygon)
+      memcpy(polygon, in, count*sizeof(vec4));
+
+   return count;
+}
+
+// Clips a batch of triangles, the result is allocated from the arena and the unused tail is given back.
+// Triangles fully outside one of the view planes are dropped, guard must be >= 1.
+static g_clip_result g_clip_triangles(arena* a, const vec4* vertices, size triangle_count, f32 guard)
+{
+   g_clip_result result = {0};
+   pre(guard >= 1.0f);
+
+   // size the output for the worst case of the triangles that need clipping
+   size capacity = 0;
+   for(size i = 0; i < triangle_count; ++i)
+   {
+      const vec4* v = vertices + i*3;
+
+      u32 reject = g_clip_outcode(v[0], 1.0f) & g_clip_outcode(v[1], 1.0f) & g_clip_outcode(v[2], 1.0f);
+      u32 clip = g_clip_outcode(v[0], guard) | g_clip_outcode(v[1], guard) | g_clip_outcode(v[2], guard);
+
+      if(!reject)
+         capacity += clip ? G_CLIP_MAX_TRIANGLES : 1;
+   }
+
+   if(capacity == 0)
+      return result;
+
+   vec4* out = new(a, vec4, capacity*3);
+   if(arena_end(a, out))
+      return result;
+
+   size count = 0;
+   for(size i = 0; i < triangle_count; ++i)
+   {
+      const vec4* v = vertices + i*3;
+
+      u32 reject = g_clip_outcode(v[0], 1.0f) & g_clip_outcode(v[1], 1.0f) & g_clip_outcode(v[2], 1.0f);
+      if(reject)
+         continue;
+
+      u32 clip = g_clip_outcode(v[0], guard) | g_clip_outcode(v[1], guard) | g_clip_outcode(v[2], guard);
+      if(!clip)
+      {
+         memcpy(out + count*3, v, 3*sizeof(vec4));
+         count++;
+         continue;
+      }
+
+      vec4 polygon[G_CLIP_MAX_VERTICES] = {v[0], v[1], v[2]};
+      i32 n = g_clip_polygon(polygon, 3, clip, guard);
+
+      // fan around the first vertex keeps the winding
+      for(i32 j = 1; j + 1 < n; ++j)
+      {
+         out[count*3 + 0] = polygon[0];
+         out[count*3 + 1] = polygon[j];
+         out[count*3 + 2] = polygon[j + 1];
+         count++;
+      }
+   }
+
+   post(count <= capacity);
+
+   arena_shrink_to(a, out, count*3*sizeof(vec4));
+
+   result.vertices = out;
+   result.count = count;
+
+   return result;
+}
+
+#endif
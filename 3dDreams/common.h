@@ -9,6 +9,7 @@
 typedef uint8_t         u8;
 typedef int32_t         i32;
 typedef uint32_t        u32;
+typedef int64_t         i64;
 typedef uint64_t        u64;
 typedef float           f32;
 typedef double          f64;
@@ -38,8 +39,17 @@ typedef struct
 #define implies(p, q) (!(p) || (q))
 
 #define custom_alignment 64
+#if defined(_MSC_VER)
+#define align_as(n) __declspec(align(n))
+#define thread_local_storage __declspec(thread)
 #define align_struct __declspec(align(custom_alignment)) typedef struct
 #define align_union __declspec(align(custom_alignment)) typedef union
+#else
+#define align_as(n) __attribute__((aligned(n)))
+#define thread_local_storage __thread
+#define align_struct typedef struct __attribute__((aligned(custom_alignment)))
+#define align_union typedef union __attribute__((aligned(custom_alignment)))
+#endif
 
 #define array_clear(a) memset((a), 0, array_count(a)*sizeof(*(a)))
 #define array_count(a) sizeof((a)) / sizeof((a)[0])
@@ -56,6 +66,7 @@ typedef struct
 #define GB(g) (1024ull)*MB((g))
 
 static const u64 default_arena_size = KB(64);
+static const u64 default_arena_reserve = GB(1);
 
 #define clamp(t, min, max) ((t) <= (min) ? (min) : (t) >= (max) ? (max) : (t))
 
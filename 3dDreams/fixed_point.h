@@ -1,14 +1,185 @@
-#if !defined(_FIXED_point_H)
+#if !defined(_FIXED_POINT_H)
 #define _FIXED_POINT_H
 
 #include "common.h"
+#include <math.h>
 
-static fp FP_to_fixed_point(f32 f, i32 scale) { return (fp)f << scale; }
+// Signed 32 bit fixed point, the number of fraction bits is passed to every operation.
+// Products and quotients go through 64 bit intermediates so they do not overflow before the shift.
+// The four lane versions use SSE4.1 with USE_SIMD and give the same results as the scalar ones.
+
+#if defined(USE_SIMD) && (defined(__SSE4_1__) || defined(__AVX__))
+#define FP_SIMD_SSE4
+#include <smmintrin.h>
+#endif
+
+typedef i32 fp;
+
+// Q16.16 for general math, Q24.8 for sub pixel screen coordinates
+enum { FP_Q16_16 = 16, FP_Q24_8 = 8 };
+
+#define FP_one(frac) ((fp)1 << (frac))
+
+typedef union
+{
+   align_as(16) fp data[4];
+#if defined(FP_SIMD_SSE4)
+   __m128i m;
+#endif
+} fp4;
+
+// Rounds to nearest even like the simd conversion
+static fp FP_to_fixed_point(f32 f, i32 frac) { return (fp)lrintf(f * (f32)FP_one(frac)); }
+
+static f32 FP_fixed_to_f32(fp a, i32 frac) { return (f32)a * (1.0f / (f32)FP_one(frac)); }
+
+static fp FP_from_int(i32 i, i32 frac) { return (fp)((u32)i << frac); }
+
+static i32 FP_floor(fp a, i32 frac) { return a >> frac; }
+
+static i32 FP_ceil(fp a, i32 frac) { return (a + FP_one(frac) - 1) >> frac; }
+
+static i32 FP_round(fp a, i32 frac) { return (a + (FP_one(frac) >> 1)) >> frac; }
 
 static fp FP_fixed_add(fp a, fp b) { return a + b; }
 
 static fp FP_fixed_sub(fp a, fp b) { return a - b; }
 
-static fp FP_fixed_mul(fp a, fp b, i32 scale) { return (a * b) / scale; }
+// Rounds half up, the half is built from one so frac 0 has no negative shift
+static fp FP_fixed_mul(fp a, fp b, i32 frac)
+{
+   return (fp)(((i64)a*b + (((i64)1 << frac) >> 1)) >> frac);
+}
+
+// Truncates toward zero
+static fp FP_fixed_div(fp a, fp b, i32 frac)
+{
+   pre(b != 0);
+
+   // multiplied rather than shifted, left shifts of negative numbers are undefined
+   return (fp)((i64)a*((i64)1 << frac) / b);
+}
+
+static fp FP_fixed_reciprocal(fp a, i32 frac)
+{
+   pre(a != 0);
+
+   return (fp)(((i64)1 << 2*frac) / a);
+}
+
+// Exact ax*by - ay*bx with 2*frac fraction bits, the edge function of a triangle rasterizer
+static i64 FP_fixed_cross(fp ax, fp ay, fp bx, fp by)
+{
+   return (i64)ax*by - (i64)ay*bx;
+}
+
+static fp4 FP_fixed4_set(fp a, fp b, fp c, fp d)
+{
+   fp4 result;
+
+   result.data[0] = a;
+   result.data[1] = b;
+   result.data[2] = c;
+   result.data[3] = d;
+
+   return result;
+}
+
+static fp4 FP_fixed4_load(const fp a[4])
+{
+   fp4 result;
+
+#if defined(FP_SIMD_SSE4)
+   result.m = _mm_loadu_si128((const __m128i*)a);
+#else
+   for(i32 i = 0; i < 4; ++i)
+      result.data[i] = a[i];
+#endif
+
+   return result;
+}
+
+static void FP_fixed4_store(fp4 a, fp result[4])
+{
+#if defined(FP_SIMD_SSE4)
+   _mm_storeu_si128((__m128i*)result, a.m);
+#else
+   for(i32 i = 0; i < 4; ++i)
+      result[i] = a.data[i];
+#endif
+}
+
+static fp4 FP_to_fixed_point4(const f32 f[4], i32 frac)
+{
+   fp4 result;
+
+#if defined(FP_SIMD_SSE4)
+   result.m = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(f), _mm_set1_ps((f32)FP_one(frac))));
+#else
+   for(i32 i = 0; i < 4; ++i)
+      result.data[i] = FP_to_fixed_point(f[i], frac);
+#endif
+
+   return result;
+}
+
+static void FP_fixed4_to_f32(fp4 a, i32 frac, f32 f[4])
+{
+#if defined(FP_SIMD_SSE4)
+   _mm_storeu_ps(f, _mm_mul_ps(_mm_cvtepi32_ps(a.m), _mm_set1_ps(1.0f / (f32)FP_one(frac))));
+#else
+   for(i32 i = 0; i < 4; ++i)
+      f[i] = FP_fixed_to_f32(a.data[i], frac);
+#endif
+}
+
+static fp4 FP_fixed4_add(fp4 a, fp4 b)
+{
+   fp4 result;
+
+#if defined(FP_SIMD_SSE4)
+   result.m = _mm_add_epi32(a.m, b.m);
+#else
+   for(i32 i = 0; i < 4; ++i)
+      result.data[i] = a.data[i] + b.data[i];
+#endif
+
+   return result;
+}
+
+static fp4 FP_fixed4_sub(fp4 a, fp4 b)
+{
+   fp4 result;
+
+#if defined(FP_SIMD_SSE4)
+   result.m = _mm_sub_epi32(a.m, b.m);
+#else
+   for(i32 i = 0; i < 4; ++i)
+      result.data[i] = a.data[i] - b.data[i];
+#endif
+
+   return result;
+}
+
+static fp4 FP_fixed4_mul(fp4 a, fp4 b, i32 frac)
+{
+   fp4 result;
+
+#if defined(FP_SIMD_SSE4)
+   const __m128i round = _mm_set1_epi64x(((i64)1 << frac) >> 1);
+   const __m128i shift = _mm_cvtsi32_si128(frac);
+
+   // 64 bit products of the even and the odd lanes, the low 32 bits after the shift do not depend on the sign fill
+   __m128i even = _mm_srl_epi64(_mm_add_epi64(_mm_mul_epi32(a.m, b.m), round), shift);
+   __m128i odd = _mm_srl_epi64(_mm_add_epi64(_mm_mul_epi32(_mm_srli_epi64(a.m, 32), _mm_srli_epi64(b.m, 32)), round), shift);
+
+   result.m = _mm_blend_epi16(even, _mm_slli_epi64(odd, 32), 0xcc);
+#else
+   for(i32 i = 0; i < 4; ++i)
+      result.data[i] = FP_fixed_mul(a.data[i], b.data[i], frac);
+#endif
+
+   return result;
+}
 
 #endif
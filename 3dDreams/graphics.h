@@ -5,22 +5,41 @@
 #include "common.h"
 #include <math.h>
 
+// Define USE_SIMD to use the simd backend of the target, picked at compile time.
+// Every simd path adds and multiplies in the same order as the scalar one so the results are bit exact,
+// as long as the compiler is not allowed to contract them into fused multiply adds.
 //#define USE_SIMD
 
 #if defined(USE_SIMD)
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+#define G_SIMD_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define G_SIMD_SSE
+#if defined(__AVX__)
+#define G_SIMD_AVX
+#endif
 #include <immintrin.h>
 #endif
+#endif
 
 enum { G_PLANE_FRONT, G_PLANE_BACK, G_PLANE_ON, G_PLANE_SPLIT };
 
+// vertices closer to a plane than this are on it, absorbs the rounding of split and coplanar faces
+#define G_PLANE_EPSILON 1e-4f
+
 #define DEG_TO_RAD(degrees) ((degrees) * (3.14159265358979323846f / 180.0f))
 
-align_union
+// Math and vertex types are tightly packed, vec4 and mat4 only to their 16 byte simd width.
+// Use align_struct explicitly for cache line aligned data.
+
+typedef union
 { 
-#if defined(USE_SIMD)
-   __declspec(align(16)) __m128 data;
-#else
-   __declspec(align(16)) f32 data[4];
+   align_as(16) f32 data[4];
+#if defined(G_SIMD_SSE)
+   __m128 m;
+#elif defined(G_SIMD_NEON)
+   float32x4_t m;
 #endif
    struct
    {
@@ -31,7 +50,7 @@ align_union
    };
 } vec4;
 
-align_union
+typedef union
 { 
    f32 data[3];
    struct
@@ -42,12 +61,12 @@ align_union
    };
 } vec3;
 
-align_struct
+typedef struct
 { 
    vec3 vertex;
 } vertex3;
 
-align_union
+typedef union
 { 
    f32 data[2];
    struct
@@ -59,31 +78,173 @@ align_union
 
 typedef vec4 quat;
 
-// Assumes row-major storage
-align_union
+// Assumes row-major storage and row vectors, v' = v*M
+typedef union
 { 
-#if defined(USE_SIMD)
-   __declspec(align(16)) vec4 rows[4];
+   align_as(16) f32 data[16];
+   vec4 rows[4];
+} mat4;
+
+static inline vec4 vec4_set(f32 x, f32 y, f32 z, f32 w)
+{
+   vec4 result;
+
+   result.x = x;
+   result.y = y;
+   result.z = z;
+   result.w = w;
+
+   return result;
+}
+
+static inline vec4 vec4_add(vec4 a, vec4 b)
+{
+   vec4 result;
+
+#if defined(G_SIMD_SSE)
+   result.m = _mm_add_ps(a.m, b.m);
+#elif defined(G_SIMD_NEON)
+   result.m = vaddq_f32(a.m, b.m);
 #else
-   __declspec(align(16)) f32 data[16];
+   for(i32 i = 0; i < 4; ++i)
+      result.data[i] = a.data[i] + b.data[i];
 #endif
-} mat4;
+
+   return result;
+}
+
+static inline vec4 vec4_sub(vec4 a, vec4 b)
+{
+   vec4 result;
+
+#if defined(G_SIMD_SSE)
+   result.m = _mm_sub_ps(a.m, b.m);
+#elif defined(G_SIMD_NEON)
+   result.m = vsubq_f32(a.m, b.m);
+#else
+   for(i32 i = 0; i < 4; ++i)
+      result.data[i] = a.data[i] - b.data[i];
+#endif
+
+   return result;
+}
+
+// Component wise
+static inline vec4 vec4_mul(vec4 a, vec4 b)
+{
+   vec4 result;
+
+#if defined(G_SIMD_SSE)
+   result.m = _mm_mul_ps(a.m, b.m);
+#elif defined(G_SIMD_NEON)
+   result.m = vmulq_f32(a.m, b.m);
+#else
+   for(i32 i = 0; i < 4; ++i)
+      result.data[i] = a.data[i] * b.data[i];
+#endif
+
+   return result;
+}
+
+static inline vec4 vec4_scale(vec4 a, f32 s)
+{
+   vec4 result;
+
+#if defined(G_SIMD_SSE)
+   result.m = _mm_mul_ps(a.m, _mm_set1_ps(s));
+#elif defined(G_SIMD_NEON)
+   result.m = vmulq_n_f32(a.m, s);
+#else
+   for(i32 i = 0; i < 4; ++i)
+      result.data[i] = a.data[i] * s;
+#endif
+
+   return result;
+}
+
+// Sums the products pairwise as (x + y) + (z + w)
+static inline f32 vec4_dot(vec4 a, vec4 b)
+{
+#if defined(G_SIMD_SSE)
+   __m128 m = _mm_mul_ps(a.m, b.m);
+   __m128 pairs = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+   return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_movehl_ps(pairs, pairs)));
+#elif defined(G_SIMD_NEON)
+   float32x4_t m = vmulq_f32(a.m, b.m);
+   float32x2_t pairs = vpadd_f32(vget_low_f32(m), vget_high_f32(m));
+   return vget_lane_f32(pairs, 0) + vget_lane_f32(pairs, 1);
+#else
+   return (a.x*b.x + a.y*b.y) + (a.z*b.z + a.w*b.w);
+#endif
+}
+
+// Cross product of the xyz parts, w is zero
+static inline vec4 vec4_cross(vec4 a, vec4 b)
+{
+   vec4 result;
+
+#if defined(G_SIMD_SSE)
+   __m128 a_yzx = _mm_shuffle_ps(a.m, a.m, _MM_SHUFFLE(3, 0, 2, 1));
+   __m128 b_yzx = _mm_shuffle_ps(b.m, b.m, _MM_SHUFFLE(3, 0, 2, 1));
+   __m128 a_zxy = _mm_shuffle_ps(a.m, a.m, _MM_SHUFFLE(3, 1, 0, 2));
+   __m128 b_zxy = _mm_shuffle_ps(b.m, b.m, _MM_SHUFFLE(3, 1, 0, 2));
+   result.m = _mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx));
+   // w came out as a.w*b.w - a.w*b.w, a nan for infinite or nan w
+   result.m = _mm_and_ps(result.m, _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1)));
+#else
+   result.x = a.y*b.z - a.z*b.y;
+   result.y = a.z*b.x - a.x*b.z;
+   result.z = a.x*b.y - a.y*b.x;
+   result.w = 0.0f;
+#endif
+
+   return result;
+}
+
+// Row vector times matrix
+static inline vec4 vec4_transform(vec4 v, mat4 m)
+{
+   vec4 result;
+
+#if defined(G_SIMD_SSE)
+   __m128 r = _mm_mul_ps(_mm_set1_ps(v.x), m.rows[0].m);
+   r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(v.y), m.rows[1].m));
+   r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(v.z), m.rows[2].m));
+   r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(v.w), m.rows[3].m));
+   result.m = r;
+#elif defined(G_SIMD_NEON)
+   float32x4_t r = vmulq_n_f32(m.rows[0].m, v.x);
+   r = vaddq_f32(r, vmulq_n_f32(m.rows[1].m, v.y));
+   r = vaddq_f32(r, vmulq_n_f32(m.rows[2].m, v.z));
+   r = vaddq_f32(r, vmulq_n_f32(m.rows[3].m, v.w));
+   result.m = r;
+#else
+   for(i32 j = 0; j < 4; ++j)
+      result.data[j] = v.x*m.data[0 + j]
+                     + v.y*m.data[4 + j]
+                     + v.z*m.data[8 + j]
+                     + v.w*m.data[12 + j];
+#endif
+
+   return result;
+}
+
+static inline vec3 vec3_transform_point(vec3 p, mat4 m)
+{
+   vec4 r = vec4_transform(vec4_set(p.x, p.y, p.z, 1.0f), m);
+   vec3 result = {{r.x, r.y, r.z}};
+
+   return result;
+}
 
 static inline mat4 mat4_identity()
 {
    mat4 result = {};
 
-#if defined(USE_SIMD)
-   result.rows[0].data.m128_f32[0] = 1.0f;
-   result.rows[1].data.m128_f32[1] = 1.0f;
-   result.rows[2].data.m128_f32[2] = 1.0f;
-   result.rows[3].data.m128_f32[3] = 1.0f;
-#else
    result.data[0] = 1.0f;
    result.data[5] = 1.0f;
    result.data[10] = 1.0f;
    result.data[15] = 1.0f;
-#endif
 
    return result;
 }
@@ -110,10 +271,35 @@ static inline mat4 mat4_translate(vec3 t)
    return result;
 }
 
+static inline mat4 mat4_transpose(mat4 m)
+{
+   mat4 result;
+
+#if defined(G_SIMD_SSE)
+   __m128 r0 = m.rows[0].m, r1 = m.rows[1].m, r2 = m.rows[2].m, r3 = m.rows[3].m;
+   _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+   result.rows[0].m = r0;
+   result.rows[1].m = r1;
+   result.rows[2].m = r2;
+   result.rows[3].m = r3;
+#else
+   for(i32 i = 0; i < 4; ++i)
+      for(i32 j = 0; j < 4; ++j)
+         result.data[i*4 + j] = m.data[j*4 + i];
+#endif
+
+   return result;
+}
+
 static inline mat4 mat4_mul(mat4 a, mat4 b)
 {
-   mat4 result = mat4_identity();
+   mat4 result;
 
+#if defined(G_SIMD_SSE) || defined(G_SIMD_NEON)
+   // every row of a transforms the rows of b
+   for(i32 i = 0; i < 4; ++i)
+      result.rows[i] = vec4_transform(a.rows[i], b);
+#else
    f32* pa = a.data;
    f32* pb = b.data;
 
@@ -131,6 +317,7 @@ static inline mat4 mat4_mul(mat4 a, mat4 b)
       }
       pa += 4; // advance to second row
    }
+#endif
 
    return result;
 }
@@ -194,6 +381,538 @@ static inline mat4 mat4_perspective_fov(f32 fovh, f32 aspect, f32 n, f32 f)
 
 }
 
+// Upper 3x3 rows must be orthogonal, a rotation with per axis scale, and the last column (0, 0, 0, 1).
+// The inverse of the 3x3 is its transpose with each column divided by the squared row length.
+static inline mat4 mat4_inverse_affine(mat4 m)
+{
+   mat4 result;
+
+#if defined(G_SIMD_SSE)
+   // kept in registers, going through the vec4 unions costs more than the math
+   __m128 c0 = m.rows[0].m, c1 = m.rows[1].m, c2 = m.rows[2].m, c3 = _mm_setzero_ps();
+   _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+   // squared row lengths, the last lane is one so it divides cleanly
+   __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, c0), _mm_mul_ps(c1, c1)), _mm_mul_ps(c2, c2));
+   __m128 inv_len2 = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(len2, _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f)));
+
+   __m128 r0 = _mm_mul_ps(c0, inv_len2), r1 = _mm_mul_ps(c1, inv_len2), r2 = _mm_mul_ps(c2, inv_len2);
+
+   __m128 t = _mm_mul_ps(_mm_set1_ps(-m.data[12]), r0);
+   t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(-m.data[13]), r1));
+   t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(-m.data[14]), r2));
+   t = _mm_add_ps(t, _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+
+   result.rows[0].m = r0;
+   result.rows[1].m = r1;
+   result.rows[2].m = r2;
+   result.rows[3].m = t;
+#else
+   vec4 inv_len2 = vec4_set(1.0f / vec4_dot(m.rows[0], m.rows[0]),
+                            1.0f / vec4_dot(m.rows[1], m.rows[1]),
+                            1.0f / vec4_dot(m.rows[2], m.rows[2]), 0.0f);
+   vec4 t = vec4_set(-m.data[12], -m.data[13], -m.data[14], 1.0f);
+
+   m.rows[3] = vec4_set(0.0f, 0.0f, 0.0f, 0.0f);
+   m = mat4_transpose(m);
+
+   for(i32 i = 0; i < 3; ++i)
+      result.rows[i] = vec4_mul(m.rows[i], inv_len2);
+   result.rows[3] = vec4_set(0.0f, 0.0f, 0.0f, 1.0f);
+
+   result.rows[3] = vec4_transform(t, result);
+#endif
+
+   return result;
+}
+
+// General inverse by cofactors built from the six 2x2 minors of rows 0, 1 and of rows 2, 3.
+// Writes the determinant, m must not be singular.
+static inline mat4 mat4_inverse_det(mat4 m, f32* determinant)
+{
+   mat4 result;
+
+#if defined(G_SIMD_SSE)
+   const __m128 r0 = m.rows[0].m, r1 = m.rows[1].m, r2 = m.rows[2].m, r3 = m.rows[3].m;
+
+   // minors of rows a, b for the column pairs 01 02 03 12 and 13 23
+   #define minors_0123(a, b) _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 0, 0, 0)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 2, 1))), \
+                                        _mm_mul_ps(_mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 0, 0, 0)), _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 2, 1))))
+   #define minors_45(a, b)   _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 1, 2, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 3, 3))), \
+                                        _mm_mul_ps(_mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 1, 2, 1)), _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3))))
+
+   const __m128 s0123 = minors_0123(r0, r1), s45 = minors_45(r0, r1);
+   const __m128 c0123 = minors_0123(r2, r3), c45 = minors_45(r2, r3);
+
+   #undef minors_0123
+   #undef minors_45
+
+   align_as(16) f32 s[8], c[8];
+   _mm_store_ps(s, s0123);
+   _mm_store_ps(s + 4, s45);
+   _mm_store_ps(c, c0123);
+   _mm_store_ps(c + 4, c45);
+
+   const f32 det = s[0]*c[5] - s[1]*c[4] + s[2]*c[3] + s[3]*c[2] - s[4]*c[1] + s[5]*c[0];
+   pre(det != 0.0f);
+
+   // k(n) is (c[n], c[n], s[n], s[n])
+   const __m128 k0 = _mm_shuffle_ps(c0123, s0123, _MM_SHUFFLE(0, 0, 0, 0));
+   const __m128 k1 = _mm_shuffle_ps(c0123, s0123, _MM_SHUFFLE(1, 1, 1, 1));
+   const __m128 k2 = _mm_shuffle_ps(c0123, s0123, _MM_SHUFFLE(2, 2, 2, 2));
+   const __m128 k3 = _mm_shuffle_ps(c0123, s0123, _MM_SHUFFLE(3, 3, 3, 3));
+   const __m128 k4 = _mm_shuffle_ps(c45, s45, _MM_SHUFFLE(0, 0, 0, 0));
+   const __m128 k5 = _mm_shuffle_ps(c45, s45, _MM_SHUFFLE(1, 1, 1, 1));
+
+   // v(j) is column j in row order 1 0 3 2
+   __m128 v0 = r1, v1 = r0, v2 = r3, v3 = r2;
+   _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+
+   const __m128 sign_even = _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+   const __m128 sign_odd = _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f);
+   const __m128 inv_det = _mm_set1_ps(1.0f / det);
+
+   #define cofactor_row(va, ka, vb, kb, vc, kc, sign) \
+      _mm_mul_ps(_mm_xor_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(va, ka), _mm_mul_ps(vb, kb)), _mm_mul_ps(vc, kc)), sign), inv_det)
+
+   result.rows[0].m = cofactor_row(v1, k5, v2, k4, v3, k3, sign_even);
+   result.rows[1].m = cofactor_row(v0, k5, v2, k2, v3, k1, sign_odd);
+   result.rows[2].m = cofactor_row(v0, k4, v1, k2, v3, k0, sign_even);
+   result.rows[3].m = cofactor_row(v0, k3, v1, k1, v2, k0, sign_odd);
+
+   #undef cofactor_row
+#else
+   f32 s[6], c[6];
+   const i32 pairs[6][2] = {{0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {2, 3}};
+
+   for(i32 i = 0; i < 6; ++i)
+   {
+      const i32 x = pairs[i][0], y = pairs[i][1];
+      s[i] = m.data[0 + x]*m.data[4 + y] - m.data[4 + x]*m.data[0 + y];
+      c[i] = m.data[8 + x]*m.data[12 + y] - m.data[12 + x]*m.data[8 + y];
+   }
+
+   const f32 det = s[0]*c[5] - s[1]*c[4] + s[2]*c[3] + s[3]*c[2] - s[4]*c[1] + s[5]*c[0];
+   pre(det != 0.0f);
+
+   const f32 inv_det = 1.0f / det;
+
+   // terms of each row as (column, minor) pairs, same layout as the simd path
+   const i32 terms[4][3][2] = {{{1, 5}, {2, 4}, {3, 3}},
+                               {{0, 5}, {2, 2}, {3, 1}},
+                               {{0, 4}, {1, 2}, {3, 0}},
+                               {{0, 3}, {1, 1}, {2, 0}}};
+   const i32 order[4] = {1, 0, 3, 2};
+
+   for(i32 i = 0; i < 4; ++i)
+   {
+      for(i32 j = 0; j < 4; ++j)
+      {
+         f32 v[3], k[3];
+         for(i32 t = 0; t < 3; ++t)
+         {
+            v[t] = m.data[order[j]*4 + terms[i][t][0]];
+            k[t] = j < 2 ? c[terms[i][t][1]] : s[terms[i][t][1]];
+         }
+
+         f32 r = v[0]*k[0] - v[1]*k[1] + v[2]*k[2];
+         result.data[i*4 + j] = ((i + j) & 1 ? -r : r) * inv_det;
+      }
+   }
+#endif
+
+   if(determinant)
+      *determinant = det;
+
+   return result;
+}
+
+static inline mat4 mat4_inverse(mat4 m)
+{
+   return mat4_inverse_det(m, 0);
+}
+
+// Quaternions are (x, y, z, w) with w the real part, rotations are unit quaternions.
+
+static inline quat quat_identity()
+{
+   return vec4_set(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+// Axis must be normalized
+static inline quat quat_from_axis_angle(vec3 axis, f32 radians)
+{
+   f32 s = sinf(radians*0.5f);
+
+   return vec4_set(axis.x*s, axis.y*s, axis.z*s, cosf(radians*0.5f));
+}
+
+static inline quat quat_conjugate(quat q)
+{
+   return vec4_set(-q.x, -q.y, -q.z, q.w);
+}
+
+static inline quat quat_normalize(quat q)
+{
+   return vec4_scale(q, 1.0f / sqrtf(vec4_dot(q, q)));
+}
+
+// Hamilton product a*b, rotates by b first and then by a
+static inline quat quat_mul(quat a, quat b)
+{
+   quat result;
+
+#if defined(G_SIMD_SSE)
+   const __m128 sign_x = _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+   const __m128 sign_y = _mm_set_ps(-0.0f, -0.0f, 0.0f, 0.0f);
+   const __m128 sign_z = _mm_set_ps(-0.0f, 0.0f, 0.0f, -0.0f);
+
+   __m128 r = _mm_mul_ps(_mm_set1_ps(a.w), b.m);
+   r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a.x), _mm_xor_ps(_mm_shuffle_ps(b.m, b.m, _MM_SHUFFLE(0, 1, 2, 3)), sign_x)));
+   r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a.y), _mm_xor_ps(_mm_shuffle_ps(b.m, b.m, _MM_SHUFFLE(1, 0, 3, 2)), sign_y)));
+   r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a.z), _mm_xor_ps(_mm_shuffle_ps(b.m, b.m, _MM_SHUFFLE(2, 3, 0, 1)), sign_z)));
+   result.m = r;
+#elif defined(G_SIMD_NEON)
+   static const f32 sign_x[4] = {1.0f, -1.0f, 1.0f, -1.0f};
+   static const f32 sign_y[4] = {1.0f, 1.0f, -1.0f, -1.0f};
+   static const f32 sign_z[4] = {-1.0f, 1.0f, 1.0f, -1.0f};
+
+   float32x4_t b_yxwz = vrev64q_f32(b.m);
+   float32x4_t b_zwxy = vextq_f32(b.m, b.m, 2);
+   float32x4_t b_wzyx = vextq_f32(b_yxwz, b_yxwz, 2);
+
+   float32x4_t r = vmulq_n_f32(b.m, a.w);
+   r = vaddq_f32(r, vmulq_n_f32(vmulq_f32(b_wzyx, vld1q_f32(sign_x)), a.x));
+   r = vaddq_f32(r, vmulq_n_f32(vmulq_f32(b_zwxy, vld1q_f32(sign_y)), a.y));
+   r = vaddq_f32(r, vmulq_n_f32(vmulq_f32(b_yxwz, vld1q_f32(sign_z)), a.z));
+   result.m = r;
+#else
+   result.x = a.w*b.x + a.x*b.w + a.y*b.z - a.z*b.y;
+   result.y = a.w*b.y - a.x*b.z + a.y*b.w + a.z*b.x;
+   result.z = a.w*b.z + a.x*b.y - a.y*b.x + a.z*b.w;
+   result.w = a.w*b.w - a.x*b.x - a.y*b.y - a.z*b.z;
+#endif
+
+   return result;
+}
+
+// Rotates the xyz part of v as v + w*t + q x t with t = 2*(q x v), w of v is kept
+static inline vec4 quat_rotate4(quat q, vec4 v)
+{
+   vec4 t = vec4_cross(q, v);
+   t = vec4_add(t, t);
+
+   return vec4_add(vec4_add(v, vec4_scale(t, q.w)), vec4_cross(q, t));
+}
+
+static inline vec3 quat_rotate(quat q, vec3 v)
+{
+   vec4 r = quat_rotate4(q, vec4_set(v.x, v.y, v.z, 0.0f));
+   vec3 result = {{r.x, r.y, r.z}};
+
+   return result;
+}
+
+// Normalized linear interpolation along the shortest arc, cheap and fine for small angles
+static inline quat quat_nlerp(quat a, quat b, f32 t)
+{
+   if(vec4_dot(a, b) < 0.0f)
+      b = vec4_scale(b, -1.0f);
+
+   return quat_normalize(vec4_add(a, vec4_scale(vec4_sub(b, a), t)));
+}
+
+// Constant angular velocity along the shortest arc, nearly parallel inputs use nlerp
+static inline quat quat_slerp(quat a, quat b, f32 t)
+{
+   f32 d = vec4_dot(a, b);
+   if(d < 0.0f)
+   {
+      b = vec4_scale(b, -1.0f);
+      d = -d;
+   }
+
+   if(d > 0.9995f)
+      return quat_nlerp(a, b, t);
+
+   f32 theta = acosf(d);
+   f32 inv_sin = 1.0f / sinf(theta);
+
+   return vec4_add(vec4_scale(a, sinf((1.0f - t)*theta)*inv_sin), vec4_scale(b, sinf(t*theta)*inv_sin));
+}
+
+// Rotation matrix of a unit quaternion for row vectors, v*M rotates v like quat_rotate
+static inline mat4 quat_to_mat4(quat q)
+{
+   mat4 result = mat4_identity();
+
+   f32 xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+   f32 xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+   f32 wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+
+   result.data[0] = 1.0f - 2.0f*(yy + zz);
+   result.data[1] = 2.0f*(xy + wz);
+   result.data[2] = 2.0f*(xz - wy);
+
+   result.data[4] = 2.0f*(xy - wz);
+   result.data[5] = 1.0f - 2.0f*(xx + zz);
+   result.data[6] = 2.0f*(yz + wx);
+
+   result.data[8] = 2.0f*(xz + wy);
+   result.data[9] = 2.0f*(yz - wx);
+   result.data[10] = 1.0f - 2.0f*(xx + yy);
+
+   return result;
+}
+
+// Upper 3x3 of m must be a pure rotation, picks the largest diagonal term for stability
+static inline quat quat_from_mat4(mat4 m)
+{
+   // r(i, j) is the column vector convention element
+   #define r(i, j) m.data[(j)*4 + (i)]
+
+   quat result;
+   f32 trace = r(0, 0) + r(1, 1) + r(2, 2);
+
+   if(trace > 0.0f)
+   {
+      f32 s = 2.0f*sqrtf(trace + 1.0f);
+      result = vec4_set((r(2, 1) - r(1, 2)) / s, (r(0, 2) - r(2, 0)) / s, (r(1, 0) - r(0, 1)) / s, 0.25f*s);
+   }
+   else if(r(0, 0) > r(1, 1) && r(0, 0) > r(2, 2))
+   {
+      f32 s = 2.0f*sqrtf(1.0f + r(0, 0) - r(1, 1) - r(2, 2));
+      result = vec4_set(0.25f*s, (r(0, 1) + r(1, 0)) / s, (r(0, 2) + r(2, 0)) / s, (r(2, 1) - r(1, 2)) / s);
+   }
+   else if(r(1, 1) > r(2, 2))
+   {
+      f32 s = 2.0f*sqrtf(1.0f + r(1, 1) - r(0, 0) - r(2, 2));
+      result = vec4_set((r(0, 1) + r(1, 0)) / s, 0.25f*s, (r(1, 2) + r(2, 1)) / s, (r(0, 2) - r(2, 0)) / s);
+   }
+   else
+   {
+      f32 s = 2.0f*sqrtf(1.0f + r(2, 2) - r(0, 0) - r(1, 1));
+      result = vec4_set((r(0, 2) + r(2, 0)) / s, (r(1, 2) + r(2, 1)) / s, 0.25f*s, (r(1, 0) - r(0, 1)) / s);
+   }
+
+   #undef r
+
+   return result;
+}
+
+// Rotation, translation and uniform scale, p' = rotate(p*scale) + translation.
+// Uniform scale keeps the composition of two transforms a transform.
+typedef struct
+{
+   quat rotation;
+   vec3 translation;
+   f32 scale;
+} trs;
+
+static inline trs trs_identity()
+{
+   trs result = {};
+
+   result.rotation = quat_identity();
+   result.scale = 1.0f;
+
+   return result;
+}
+
+static inline vec3 trs_point(trs t, vec3 p)
+{
+   vec4 r = quat_rotate4(t.rotation, vec4_set(p.x*t.scale, p.y*t.scale, p.z*t.scale, 0.0f));
+   vec3 result = {{r.x + t.translation.x, r.y + t.translation.y, r.z + t.translation.z}};
+
+   return result;
+}
+
+// Same order as mat4_mul, applies a first and then b
+static inline trs trs_mul(trs a, trs b)
+{
+   trs result;
+
+   vec4 t = vec4_set(a.translation.x, a.translation.y, a.translation.z, 0.0f);
+   t = vec4_add(quat_rotate4(b.rotation, vec4_scale(t, b.scale)), vec4_set(b.translation.x, b.translation.y, b.translation.z, 0.0f));
+
+   result.rotation = quat_mul(b.rotation, a.rotation);
+   result.translation.x = t.x;
+   result.translation.y = t.y;
+   result.translation.z = t.z;
+   result.scale = a.scale*b.scale;
+
+   return result;
+}
+
+static inline trs trs_inverse(trs t)
+{
+   pre(t.scale != 0.0f);
+
+   trs result;
+
+   result.rotation = quat_conjugate(t.rotation);
+   result.scale = 1.0f / t.scale;
+
+   vec4 r = vec4_set(-t.translation.x, -t.translation.y, -t.translation.z, 0.0f);
+   r = vec4_scale(quat_rotate4(result.rotation, r), result.scale);
+
+   result.translation.x = r.x;
+   result.translation.y = r.y;
+   result.translation.z = r.z;
+
+   return result;
+}
+
+static inline mat4 trs_to_mat4(trs t)
+{
+   mat4 result = quat_to_mat4(t.rotation);
+
+   for(i32 i = 0; i < 3; ++i)
+      result.rows[i] = vec4_scale(result.rows[i], t.scale);
+
+   result.data[12] = t.translation.x;
+   result.data[13] = t.translation.y;
+   result.data[14] = t.translation.z;
+
+   return result;
+}
+
+// Local to world for a hierarchy stored parents first, roots have a negative parent
+static void trs_hierarchy_update(const trs* local, const i32* parent, size n, trs* world)
+{
+   for(size i = 0; i < n; ++i)
+   {
+      pre(parent[i] < (i32)i);
+
+      world[i] = parent[i] < 0 ? local[i] : trs_mul(local[i], world[parent[i]]);
+   }
+}
+
+// Batched transform of n positions stored as structure of arrays, w is implicitly one.
+// With divide the outputs are perspective divided, ow gets the clip w and may be zero.
+static void g_transform_soa_scalar(mat4 m, const f32* x, const f32* y, const f32* z, size n,
+                                   f32* ox, f32* oy, f32* oz, f32* ow, bool divide)
+{
+   const f32* d = m.data;
+
+   for(size i = 0; i < n; ++i)
+   {
+      const f32 px = x[i], py = y[i], pz = z[i];
+
+      f32 tx = px*d[0] + py*d[4] + pz*d[8]  + d[12];
+      f32 ty = px*d[1] + py*d[5] + pz*d[9]  + d[13];
+      f32 tz = px*d[2] + py*d[6] + pz*d[10] + d[14];
+      f32 tw = px*d[3] + py*d[7] + pz*d[11] + d[15];
+
+      if(divide)
+      {
+         tx /= tw;
+         ty /= tw;
+         tz /= tw;
+      }
+
+      ox[i] = tx;
+      oy[i] = ty;
+      oz[i] = tz;
+      if(ow)
+         ow[i] = tw;
+   }
+}
+
+#if defined(G_SIMD_SSE)
+static void g_transform_soa_sse(mat4 m, const f32* x, const f32* y, const f32* z, size n,
+                                f32* ox, f32* oy, f32* oz, f32* ow, bool divide)
+{
+   const f32* d = m.data;
+   size i = 0;
+
+   for(; i + 4 <= n; i += 4)
+   {
+      const __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+      __m128 t[4];
+
+      // one output component per matrix column
+      for(i32 j = 0; j < 4; ++j)
+      {
+         __m128 r = _mm_mul_ps(px, _mm_set1_ps(d[j]));
+         r = _mm_add_ps(r, _mm_mul_ps(py, _mm_set1_ps(d[4 + j])));
+         r = _mm_add_ps(r, _mm_mul_ps(pz, _mm_set1_ps(d[8 + j])));
+         t[j] = _mm_add_ps(r, _mm_set1_ps(d[12 + j]));
+      }
+
+      if(divide)
+      {
+         t[0] = _mm_div_ps(t[0], t[3]);
+         t[1] = _mm_div_ps(t[1], t[3]);
+         t[2] = _mm_div_ps(t[2], t[3]);
+      }
+
+      _mm_storeu_ps(ox + i, t[0]);
+      _mm_storeu_ps(oy + i, t[1]);
+      _mm_storeu_ps(oz + i, t[2]);
+      if(ow)
+         _mm_storeu_ps(ow + i, t[3]);
+   }
+
+   // remainder
+   g_transform_soa_scalar(m, x + i, y + i, z + i, n - i, ox + i, oy + i, oz + i, ow ? ow + i : 0, divide);
+}
+#endif
+
+#if defined(G_SIMD_AVX)
+static void g_transform_soa_avx(mat4 m, const f32* x, const f32* y, const f32* z, size n,
+                                f32* ox, f32* oy, f32* oz, f32* ow, bool divide)
+{
+   const f32* d = m.data;
+   size i = 0;
+
+   for(; i + 8 <= n; i += 8)
+   {
+      const __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+      __m256 t[4];
+
+      for(i32 j = 0; j < 4; ++j)
+      {
+         __m256 r = _mm256_mul_ps(px, _mm256_set1_ps(d[j]));
+         r = _mm256_add_ps(r, _mm256_mul_ps(py, _mm256_set1_ps(d[4 + j])));
+         r = _mm256_add_ps(r, _mm256_mul_ps(pz, _mm256_set1_ps(d[8 + j])));
+         t[j] = _mm256_add_ps(r, _mm256_set1_ps(d[12 + j]));
+      }
+
+      if(divide)
+      {
+         t[0] = _mm256_div_ps(t[0], t[3]);
+         t[1] = _mm256_div_ps(t[1], t[3]);
+         t[2] = _mm256_div_ps(t[2], t[3]);
+      }
+
+      _mm256_storeu_ps(ox + i, t[0]);
+      _mm256_storeu_ps(oy + i, t[1]);
+      _mm256_storeu_ps(oz + i, t[2]);
+      if(ow)
+         _mm256_storeu_ps(ow + i, t[3]);
+   }
+
+   // remainder
+   g_transform_soa_sse(m, x + i, y + i, z + i, n - i, ox + i, oy + i, oz + i, ow ? ow + i : 0, divide);
+}
+#endif
+
+// Widest kernel the target was compiled for
+static void g_transform_soa(mat4 m, const f32* x, const f32* y, const f32* z, size n,
+                            f32* ox, f32* oy, f32* oz, f32* ow, bool divide)
+{
+   pre(n >= 0);
+
+#if defined(G_SIMD_AVX)
+   g_transform_soa_avx(m, x, y, z, n, ox, oy, oz, ow, divide);
+#elif defined(G_SIMD_SSE)
+   g_transform_soa_sse(m, x, y, z, n, ox, oy, oz, ow, divide);
+#else
+   g_transform_soa_scalar(m, x, y, z, n, ox, oy, oz, ow, divide);
+#endif
+}
+
 // TODO: Also maybe we should remove these defines and just do functions..
 // TODO: typedefs for vertexes as float arrays to keeep them conceptually separate from directed vectors
 #define vec3_cross(a, b, c) (c).x = (a).y*(b).z - (a).z*(b).y; (c).y = (a).z*(b).x - (a).x*(b).z; (c).z = (a).x*(b).y - (a).y*(b).x;
@@ -208,17 +927,17 @@ static vec3 vec3_cross(const vec3* a, const vec3* b)
 
 // Should move the vector math to common math file
 
-#define vec3_dot(a, b) (a).x*(b).x + (a).y*(b).y + (a).z*(b).z
+#define vec3_dot(a, b) ((a).x*(b).x + (a).y*(b).y + (a).z*(b).z)
 
 static vec3 vec3_sub(const vec3* a, const vec3* b) 
 {
-   vec3 v = {b->x - a->x, b->y - a->y, b->z - a->z};
+   vec3 v = {{b->x - a->x, b->y - a->y, b->z - a->z}};
    return v;
 }
 
 static vec3 vec3_add(const vec3* a, const vec3* b) 
 {
-   vec3 v = {b->x + a->x, b->y + a->y, b->z + a->z};
+   vec3 v = {{b->x + a->x, b->y + a->y, b->z + a->z}};
    return v;
 }
 
@@ -228,17 +947,25 @@ static vec3 vec3_add(const vec3* a, const vec3* b)
 #define vec3_normalize(a) { f32 l = vec3_len((a)); (a).x /= l; (a).y /= l; (a).z /= l;}
 
 // normal and othogonal distance to the origin
-align_struct g_plane { vec3 n; f32 d; } g_plane;
+typedef struct g_plane { vec3 n; f32 d; } g_plane;
 
+// Axis aligned box by its corners
+typedef struct g_aabb { vec3 min; vec3 max; } g_aabb;
+
+// plane normals point out of the frustum so inside is G_PLANE_BACK
 align_struct g_frustum { g_plane l,r,t,b,n,f; } g_frustum;
 
+enum { G_FRUSTUM_PLANE_COUNT = 6 };
+
+#define g_frustum_planes(f) ((const g_plane*)(f))
+
 static int g_plane_classify_vertex_side(g_plane* plane, f32 vertex[3])
 {
    // normal plane equation
    f32 p = plane->n.x*vertex[0] + plane->n.y*vertex[1] + plane->n.z*vertex[2] + plane->d;
 
-   if(p > 0.0f) return G_PLANE_FRONT;
-   if(p < 0.0f) return G_PLANE_BACK;
+   if(p > G_PLANE_EPSILON) return G_PLANE_FRONT;
+   if(p < -G_PLANE_EPSILON) return G_PLANE_BACK;
    return G_PLANE_ON;
 }
 
@@ -278,11 +1005,14 @@ static void g_plane_create(g_plane* plane, const vec3* a, const vec3* b, const v
    plane->d = -vec3_dot(*a, n);
 }
 
-static void g_frustum_create(g_frustum* frustum, f32 w, f32 h, f32 hfov)
+// View space frustum of a camera looking down -z with near and far distances n and f
+static void g_frustum_create(g_frustum* frustum, f32 w, f32 h, f32 hfov, f32 n, f32 f)
 {
+   pre(0.0f < n && n < f);
+
    f32 xr, xl, yb, yt;
    f32 z = w / (2.0f*tanf(DEG_TO_RAD(hfov/2.0f)));
-   const vec3 origin = {0.0f, 0.0f, 0.0f};
+   const vec3 origin = {{0.0f, 0.0f, 0.0f}};
    vec3 vlb, vlt, vrb, vrt, vtl, vtr, vbl, vbr;
 
    xl = -w / (2*z);
@@ -313,6 +1043,42 @@ static void g_frustum_create(g_frustum* frustum, f32 w, f32 h, f32 hfov)
    g_plane_create(&frustum->r, &origin, &vrb, &vrt);
    g_plane_create(&frustum->t, &origin, &vtr, &vtl);
    g_plane_create(&frustum->b, &origin, &vbl, &vbr);
+
+   // near faces the camera and far faces away from it
+   frustum->n.n.x = 0.0f; frustum->n.n.y = 0.0f; frustum->n.n.z = 1.0f;
+   frustum->n.d = n;
+
+   frustum->f.n.x = 0.0f; frustum->f.n.y = 0.0f; frustum->f.n.z = -1.0f;
+   frustum->f.d = -f;
+}
+
+// Extracts the planes of a row vector view projection matrix in the space it transforms from,
+// assumes the 0 <= z <= w depth range
+static void g_frustum_from_matrix(g_frustum* frustum, mat4 m)
+{
+   // sign and column of the clip space inequality for every plane, inside is w + sign*clip[column] >= 0
+   const f32 signs[G_FRUSTUM_PLANE_COUNT] = {1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f};
+   const i32 columns[G_FRUSTUM_PLANE_COUNT] = {0, 0, 1, 1, 2, 2};
+   g_plane* planes = (g_plane*)frustum;
+
+   for(i32 i = 0; i < G_FRUSTUM_PLANE_COUNT; ++i)
+   {
+      const i32 c = columns[i];
+      // near is z >= 0 without the w term
+      const f32 w = i == 4 ? 0.0f : 1.0f;
+      f32 p[4];
+
+      // negate so the normals point out
+      for(i32 j = 0; j < 4; ++j)
+         p[j] = -(w*m.data[j*4 + 3] + signs[i]*m.data[j*4 + c]);
+
+      const f32 l = sqrtf(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+
+      planes[i].n.x = p[0] / l;
+      planes[i].n.y = p[1] / l;
+      planes[i].n.z = p[2] / l;
+      planes[i].d = p[3] / l;
+   }
 }
 
 static bool g_plane_intersect_segment(g_plane* plane, f32 v0[3], f32 v1[3], f32 vi[3])
@@ -341,4 +1107,234 @@ static bool g_plane_intersect_segment(g_plane* plane, f32 v0[3], f32 v1[3], f32
    return true;
 }
 
+// Batched culling of bounding volumes stored as structure of arrays. The indexes of the
+// volumes not fully outside a plane are compacted into visible which must hold n entries.
+
+// Tests the range [first, last) and appends to visible, returns the appended count
+static size g_frustum_cull_spheres_range(const g_frustum* frustum, const f32* x, const f32* y, const f32* z, const f32* r,
+                                         size first, size last, u32* visible)
+{
+   const g_plane* planes = g_frustum_planes(frustum);
+   size count = 0;
+
+   for(size i = first; i < last; ++i)
+   {
+      bool inside = true;
+      for(i32 j = 0; j < G_FRUSTUM_PLANE_COUNT; ++j)
+         inside &= planes[j].n.x*x[i] + planes[j].n.y*y[i] + planes[j].n.z*z[i] + planes[j].d <= r[i];
+
+      // branchless compaction
+      visible[count] = (u32)i;
+      count += inside;
+   }
+
+   return count;
+}
+
+static size g_frustum_cull_aabbs_range(const g_frustum* frustum, const f32* cx, const f32* cy, const f32* cz,
+                                       const f32* ex, const f32* ey, const f32* ez, size first, size last, u32* visible)
+{
+   const g_plane* planes = g_frustum_planes(frustum);
+   size count = 0;
+
+   for(size i = first; i < last; ++i)
+   {
+      bool inside = true;
+      for(i32 j = 0; j < G_FRUSTUM_PLANE_COUNT; ++j)
+      {
+         // projected radius of the box onto the plane normal
+         const f32 radius = fabsf(planes[j].n.x)*ex[i] + fabsf(planes[j].n.y)*ey[i] + fabsf(planes[j].n.z)*ez[i];
+         inside &= planes[j].n.x*cx[i] + planes[j].n.y*cy[i] + planes[j].n.z*cz[i] + planes[j].d <= radius;
+      }
+
+      visible[count] = (u32)i;
+      count += inside;
+   }
+
+   return count;
+}
+
+static size g_frustum_cull_spheres_scalar(const g_frustum* frustum, const f32* x, const f32* y, const f32* z, const f32* r,
+                                          size n, u32* visible)
+{
+   return g_frustum_cull_spheres_range(frustum, x, y, z, r, 0, n, visible);
+}
+
+static size g_frustum_cull_aabbs_scalar(const g_frustum* frustum, const f32* cx, const f32* cy, const f32* cz,
+                                        const f32* ex, const f32* ey, const f32* ez, size n, u32* visible)
+{
+   return g_frustum_cull_aabbs_range(frustum, cx, cy, cz, ex, ey, ez, 0, n, visible);
+}
+
+#if defined(G_SIMD_SSE)
+static size g_frustum_cull_spheres_sse(const g_frustum* frustum, const f32* x, const f32* y, const f32* z, const f32* r,
+                                       size n, u32* visible)
+{
+   const g_plane* planes = g_frustum_planes(frustum);
+   size count = 0, i = 0;
+
+   for(; i + 4 <= n; i += 4)
+   {
+      const __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i), pr = _mm_loadu_ps(r + i);
+      __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+      for(i32 j = 0; j < G_FRUSTUM_PLANE_COUNT; ++j)
+      {
+         __m128 d = _mm_mul_ps(px, _mm_set1_ps(planes[j].n.x));
+         d = _mm_add_ps(d, _mm_mul_ps(py, _mm_set1_ps(planes[j].n.y)));
+         d = _mm_add_ps(d, _mm_mul_ps(pz, _mm_set1_ps(planes[j].n.z)));
+         d = _mm_add_ps(d, _mm_set1_ps(planes[j].d));
+         inside = _mm_and_ps(inside, _mm_cmple_ps(d, pr));
+      }
+
+      const i32 mask = _mm_movemask_ps(inside);
+      for(i32 k = 0; k < 4; ++k)
+      {
+         visible[count] = (u32)(i + k);
+         count += (mask >> k) & 1;
+      }
+   }
+
+   // remainder
+   return count + g_frustum_cull_spheres_range(frustum, x, y, z, r, i, n, visible + count);
+}
+
+static size g_frustum_cull_aabbs_sse(const g_frustum* frustum, const f32* cx, const f32* cy, const f32* cz,
+                                     const f32* ex, const f32* ey, const f32* ez, size n, u32* visible)
+{
+   const g_plane* planes = g_frustum_planes(frustum);
+   size count = 0, i = 0;
+
+   for(; i + 4 <= n; i += 4)
+   {
+      const __m128 px = _mm_loadu_ps(cx + i), py = _mm_loadu_ps(cy + i), pz = _mm_loadu_ps(cz + i);
+      const __m128 qx = _mm_loadu_ps(ex + i), qy = _mm_loadu_ps(ey + i), qz = _mm_loadu_ps(ez + i);
+      __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+      for(i32 j = 0; j < G_FRUSTUM_PLANE_COUNT; ++j)
+      {
+         __m128 radius = _mm_mul_ps(qx, _mm_set1_ps(fabsf(planes[j].n.x)));
+         radius = _mm_add_ps(radius, _mm_mul_ps(qy, _mm_set1_ps(fabsf(planes[j].n.y))));
+         radius = _mm_add_ps(radius, _mm_mul_ps(qz, _mm_set1_ps(fabsf(planes[j].n.z))));
+
+         __m128 d = _mm_mul_ps(px, _mm_set1_ps(planes[j].n.x));
+         d = _mm_add_ps(d, _mm_mul_ps(py, _mm_set1_ps(planes[j].n.y)));
+         d = _mm_add_ps(d, _mm_mul_ps(pz, _mm_set1_ps(planes[j].n.z)));
+         d = _mm_add_ps(d, _mm_set1_ps(planes[j].d));
+         inside = _mm_and_ps(inside, _mm_cmple_ps(d, radius));
+      }
+
+      const i32 mask = _mm_movemask_ps(inside);
+      for(i32 k = 0; k < 4; ++k)
+      {
+         visible[count] = (u32)(i + k);
+         count += (mask >> k) & 1;
+      }
+   }
+
+   // remainder
+   return count + g_frustum_cull_aabbs_range(frustum, cx, cy, cz, ex, ey, ez, i, n, visible + count);
+}
+#endif
+
+#if defined(G_SIMD_AVX)
+static size g_frustum_cull_spheres_avx(const g_frustum* frustum, const f32* x, const f32* y, const f32* z, const f32* r,
+                                       size n, u32* visible)
+{
+   const g_plane* planes = g_frustum_planes(frustum);
+   size count = 0, i = 0;
+
+   for(; i + 8 <= n; i += 8)
+   {
+      const __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i), pr = _mm256_loadu_ps(r + i);
+      __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+      for(i32 j = 0; j < G_FRUSTUM_PLANE_COUNT; ++j)
+      {
+         __m256 d = _mm256_mul_ps(px, _mm256_set1_ps(planes[j].n.x));
+         d = _mm256_add_ps(d, _mm256_mul_ps(py, _mm256_set1_ps(planes[j].n.y)));
+         d = _mm256_add_ps(d, _mm256_mul_ps(pz, _mm256_set1_ps(planes[j].n.z)));
+         d = _mm256_add_ps(d, _mm256_set1_ps(planes[j].d));
+         inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, pr, _CMP_LE_OQ));
+      }
+
+      const i32 mask = _mm256_movemask_ps(inside);
+      for(i32 k = 0; k < 8; ++k)
+      {
+         visible[count] = (u32)(i + k);
+         count += (mask >> k) & 1;
+      }
+   }
+
+   // remainder
+   return count + g_frustum_cull_spheres_range(frustum, x, y, z, r, i, n, visible + count);
+}
+
+static size g_frustum_cull_aabbs_avx(const g_frustum* frustum, const f32* cx, const f32* cy, const f32* cz,
+                                     const f32* ex, const f32* ey, const f32* ez, size n, u32* visible)
+{
+   const g_plane* planes = g_frustum_planes(frustum);
+   size count = 0, i = 0;
+
+   for(; i + 8 <= n; i += 8)
+   {
+      const __m256 px = _mm256_loadu_ps(cx + i), py = _mm256_loadu_ps(cy + i), pz = _mm256_loadu_ps(cz + i);
+      const __m256 qx = _mm256_loadu_ps(ex + i), qy = _mm256_loadu_ps(ey + i), qz = _mm256_loadu_ps(ez + i);
+      __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+      for(i32 j = 0; j < G_FRUSTUM_PLANE_COUNT; ++j)
+      {
+         __m256 radius = _mm256_mul_ps(qx, _mm256_set1_ps(fabsf(planes[j].n.x)));
+         radius = _mm256_add_ps(radius, _mm256_mul_ps(qy, _mm256_set1_ps(fabsf(planes[j].n.y))));
+         radius = _mm256_add_ps(radius, _mm256_mul_ps(qz, _mm256_set1_ps(fabsf(planes[j].n.z))));
+
+         __m256 d = _mm256_mul_ps(px, _mm256_set1_ps(planes[j].n.x));
+         d = _mm256_add_ps(d, _mm256_mul_ps(py, _mm256_set1_ps(planes[j].n.y)));
+         d = _mm256_add_ps(d, _mm256_mul_ps(pz, _mm256_set1_ps(planes[j].n.z)));
+         d = _mm256_add_ps(d, _mm256_set1_ps(planes[j].d));
+         inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, radius, _CMP_LE_OQ));
+      }
+
+      const i32 mask = _mm256_movemask_ps(inside);
+      for(i32 k = 0; k < 8; ++k)
+      {
+         visible[count] = (u32)(i + k);
+         count += (mask >> k) & 1;
+      }
+   }
+
+   // remainder
+   return count + g_frustum_cull_aabbs_range(frustum, cx, cy, cz, ex, ey, ez, i, n, visible + count);
+}
+#endif
+
+// Widest kernel the target was compiled for
+static size g_frustum_cull_spheres(const g_frustum* frustum, const f32* x, const f32* y, const f32* z, const f32* r,
+                                   size n, u32* visible)
+{
+   pre(n >= 0 && n <= (size)UINT32_MAX);
+
+#if defined(G_SIMD_AVX)
+   return g_frustum_cull_spheres_avx(frustum, x, y, z, r, n, visible);
+#elif defined(G_SIMD_SSE)
+   return g_frustum_cull_spheres_sse(frustum, x, y, z, r, n, visible);
+#else
+   return g_frustum_cull_spheres_scalar(frustum, x, y, z, r, n, visible);
+#endif
+}
+
+static size g_frustum_cull_aabbs(const g_frustum* frustum, const f32* cx, const f32* cy, const f32* cz,
+                                 const f32* ex, const f32* ey, const f32* ez, size n, u32* visible)
+{
+   pre(n >= 0 && n <= (size)UINT32_MAX);
+
+#if defined(G_SIMD_AVX)
+   return g_frustum_cull_aabbs_avx(frustum, cx, cy, cz, ex, ey, ez, n, visible);
+#elif defined(G_SIMD_SSE)
+   return g_frustum_cull_aabbs_sse(frustum, cx, cy, cz, ex, ey, ez, n, visible);
+#else
+   return g_frustum_cull_aabbs_scalar(frustum, cx, cy, cz, ex, ey, ez, n, visible);
+#endif
+}
+
 #endif
@@ -30,14 +30,18 @@ align_struct hw
    bool finished;
 } hw;
 
+#if defined(_WIN32)
 //#include "d3d12.c"
 #include "vulkan.c"
+#endif
 
 void hw_window_open(hw* hw, const char *title, int x, int y, int width, int height)
 {
    hw->renderer.window.handle = hw->renderer.window.open(title, x, y, width, height);
    inv(hw->renderer.window.handle);
+#if defined(_WIN32)
    SetWindowLongPtr(hw->renderer.window.handle, GWLP_USERDATA, (LONG_PTR)&hw->renderer);
+#endif
 }
 
 void hw_window_close(hw* hw)
@@ -46,11 +50,68 @@ void hw_window_close(hw* hw)
    hw->renderer.window.close(hw->renderer.window);
 }
 
+enum { HW_SCRATCH_COUNT = 2 };
+
+// defined by the platform
+static arena arena_new(size cap, u32 flags);
+static void arena_free(arena* a);
+
+static thread_local_storage arena hw_thread_scratch[HW_SCRATCH_COUNT];
+
+bool scratch_thread_create(size cap)
+{
+   for(u32 i = 0; i < HW_SCRATCH_COUNT; ++i)
+   {
+      pre(!hw_thread_scratch[i].header);
+
+      hw_thread_scratch[i] = arena_new(cap, 0);
+      if(!hw_thread_scratch[i].header)
+      {
+         scratch_thread_release();
+         return false;
+      }
+   }
+
+   return true;
+}
+
+void scratch_thread_release(void)
+{
+   for(u32 i = 0; i < HW_SCRATCH_COUNT; ++i)
+      arena_free(&hw_thread_scratch[i]);
+}
+
+arena scratch_get(const arena* conflict)
+{
+   for(u32 i = 0; i < HW_SCRATCH_COUNT; ++i)
+   {
+      const arena_header* header = hw_thread_scratch[i].header;
+      pre(header);
+
+      // nested helpers pass their caller's arena so they never stomp it
+      if(conflict && (byte*)conflict->beg >= (byte*)header && conflict->beg <= header->end)
+         continue;
+
+      return hw_thread_scratch[i];
+   }
+
+   // more nesting levels than scratch arenas
+   hw_assert(!"scratch_get");
+
+   return (arena){0};
+}
+
 #define MSEC_PER_SIM (16)
 
+// zero the used part of the scratch every frame, 0 only rewinds it
+#if !defined(HW_SCRATCH_ZERO)
+#define HW_SCRATCH_ZERO 1
+#endif
+
 static f32 global_game_time_residual;
 static int global_game_frame;
 
+#if defined(_WIN32)
 static LARGE_INTEGER GetWallClock()
 {
 	LARGE_INTEGER result;
@@ -65,6 +126,7 @@ static f32 GetSecondsElapsed(LARGE_INTEGER start, LARGE_INTEGER end)
 {
    return ((f32)end.QuadPart - start.QuadPart) / (f32)global_perf_counter_frequency;
 }
+#endif
 
 #if 0
 static void hw_frame_sync2(hw* hw)
@@ -147,7 +209,7 @@ void hw_event_loop_start(hw* hw, void (*app_frame_function)(arena scratch), void
 
       app_input_function(&input);
       app_frame_function(hw->vulkan_scratch);
-      scratch_clear(hw->vulkan_scratch);
+      scratch_reset(&hw->vulkan_scratch, HW_SCRATCH_ZERO);
 
       // TODO: Use perf counters for better granularity
       hw_frame_sync(hw);
@@ -4,8 +4,11 @@
 #if _WIN32
 #define hw_message(p) { MessageBoxA(0, #p, "Assertion", MB_OK); __debugbreak(); }
 #pragma comment(lib,	"winmm.lib") // timers etc.
-#elif
-// other plats like linux, osx and ios
+#elif defined(__linux__)
+#include <stdio.h>
+#define hw_message(p) { fprintf(stderr, "Assertion: %s\n", #p); __builtin_trap(); }
+#else
+// other plats like osx and ios
 #endif
 
 // Every platform should define hw_message
@@ -22,6 +25,7 @@ enum
 
 typedef struct hw hw;
 typedef struct arena arena;
+struct app_input;
 
 typedef enum { HW_INPUT_TYPE_KEY, HW_INPUT_TYPE_MOUSE, HW_INPUT_TYPE_TOUCH } hw_input_type;
 
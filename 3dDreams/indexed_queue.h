@@ -0,0 +1,232 @@
+#if !defined(_INDEXED_QUEUE_H)
+#define _INDEXED_QUEUE_H
+
+#include "common.h"
+#include "arena.h"
+
+// d-ary heap of handles with a position map, so the key of a queued handle can change or the
+// handle can leave in O(log n) without a search. Handles are small integers below the count
+// passed to indexed_queue_init, like texture, mesh or graph node indexes. Define before including:
+//
+//    indexed_queue_key             optional, key type, f32 by default
+//    indexed_queue_before(a, b)    optional, true if key a leaves the queue before key b, the smallest first by default
+//    INDEXED_QUEUE_CHECK           optional, checks the whole heap after every operation in debug builds
+#if 0
+#define indexed_queue_key u32
+#define indexed_queue_before(a, b) ((a) > (b)) // max heap
+#include "indexed_queue.h"
+#endif
+
+#if !defined(indexed_queue_key)
+#define indexed_queue_key f32
+#endif
+
+#if !defined(indexed_queue_before)
+#define indexed_queue_before(a, b) ((a) < (b))
+#endif
+
+#if defined(INDEXED_QUEUE_CHECK)
+#define indexed_queue_check(q) inv(indexed_queue_invariant(q))
+#else
+#define indexed_queue_check(q)
+#endif
+
+#define indexed_queue_null             ((u32)-1)
+
+#define indexed_queue_parent(q, i)     (((i) - 1) >> (q)->shift)
+#define indexed_queue_child(q, i)      (((i) << (q)->shift) + 1)
+#define indexed_queue_empty(q)         ((q)->count == 0)
+#define indexed_queue_contains(q, h)   ((q)->position[(h)] != indexed_queue_null)
+
+// keys sit next to their handles so sifting never touches the position map for comparisons
+typedef struct indexed_queue_entry
+{
+   indexed_queue_key key;
+   u32 handle;
+} indexed_queue_entry;
+
+typedef struct indexed_queue
+{
+   indexed_queue_entry* heap;
+   u32* position;    // heap slot of every handle, indexed_queue_null when not queued
+   u32 count;
+   u32 handle_count;
+   u32 shift;        // log2 of the arity
+} indexed_queue;
+
+// Handles run from 0 to handle_count - 1, arity of 2, 4 or 8. False when the arena is out of memory
+static bool indexed_queue_init(indexed_queue* queue, arena* a, u32 handle_count, u32 arity)
+{
+   pre(arity == 2 || arity == 4 || arity == 8);
+   pre(handle_count > 0 && handle_count < indexed_queue_null);
+
+   queue->heap = new(a, indexed_queue_entry, handle_count);
+   queue->position = new(a, u32, handle_count);
+   if(arena_end(a, queue->heap) || arena_end(a, queue->position))
+      return false;
+
+   memset(queue->position, 0xff, handle_count*sizeof(u32));
+
+   queue->count = 0;
+   queue->handle_count = handle_count;
+   queue->shift = arity == 2 ? 1 : arity == 4 ? 2 : 3;
+
+   return true;
+}
+
+// O(n), only for checks
+static bool indexed_queue_invariant(const indexed_queue* queue)
+{
+   for(u32 i = 0; i < queue->count; ++i)
+   {
+      if(queue->position[queue->heap[i].handle] != i)
+         return false;
+      if(i > 0 && indexed_queue_before(queue->heap[i].key, queue->heap[indexed_queue_parent(queue, i)].key))
+         return false;
+   }
+
+   return true;
+}
+
+static void indexed_queue_place(indexed_queue* queue, u32 i, indexed_queue_entry entry)
+{
+   queue->heap[i] = entry;
+   queue->position[entry.handle] = i;
+}
+
+// Moves the hole at i up until entry fits
+static void indexed_queue_sift_up(indexed_queue* queue, u32 i, indexed_queue_entry entry)
+{
+   while(i > 0)
+   {
+      u32 parent = indexed_queue_parent(queue, i);
+      if(!indexed_queue_before(entry.key, queue->heap[parent].key))
+         break;
+
+      indexed_queue_place(queue, i, queue->heap[parent]);
+      i = parent;
+   }
+
+   indexed_queue_place(queue, i, entry);
+}
+
+// Moves the hole at i down past every child that leaves before entry
+static void indexed_queue_sift_down(indexed_queue* queue, u32 i, indexed_queue_entry entry)
+{
+   const u32 count = queue->count;
+   const u32 arity = 1u << queue->shift;
+
+   for(;;)
+   {
+      u32 first = indexed_queue_child(queue, i);
+      if(first >= count)
+         break;
+
+      u32 last = first + arity < count ? first + arity : count;
+      u32 best = first;
+      for(u32 c = first + 1; c < last; ++c)
+         if(indexed_queue_before(queue->heap[c].key, queue->heap[best].key))
+            best = c;
+
+      if(!indexed_queue_before(queue->heap[best].key, entry.key))
+         break;
+
+      indexed_queue_place(queue, i, queue->heap[best]);
+      i = best;
+   }
+
+   indexed_queue_place(queue, i, entry);
+}
+
+// Puts the entry into the hole at i, whichever way it has to go
+static void indexed_queue_sift(indexed_queue* queue, u32 i, indexed_queue_entry entry)
+{
+   if(i > 0 && indexed_queue_before(entry.key, queue->heap[indexed_queue_parent(queue, i)].key))
+      indexed_queue_sift_up(queue, i, entry);
+   else
+      indexed_queue_sift_down(queue, i, entry);
+}
+
+static void indexed_queue_insert(indexed_queue* queue, u32 handle, indexed_queue_key key)
+{
+   pre(handle < queue->handle_count);
+   pre(!indexed_queue_contains(queue, handle));
+
+   indexed_queue_entry entry = {key, handle};
+   indexed_queue_sift_up(queue, queue->count++, entry);
+
+   indexed_queue_check(queue);
+}
+
+// Changes the key of a queued handle or inserts it, a key that did not change costs one compare
+static void indexed_queue_update_key(indexed_queue* queue, u32 handle, indexed_queue_key key)
+{
+   pre(handle < queue->handle_count);
+
+   u32 i = queue->position[handle];
+   if(i == indexed_queue_null)
+   {
+      indexed_queue_insert(queue, handle, key);
+      return;
+   }
+
+   indexed_queue_entry entry = {key, handle};
+   indexed_queue_sift(queue, i, entry);
+
+   indexed_queue_check(queue);
+}
+
+static indexed_queue_key indexed_queue_get_key(const indexed_queue* queue, u32 handle)
+{
+   pre(handle < queue->handle_count && indexed_queue_contains(queue, handle));
+
+   return queue->heap[queue->position[handle]].key;
+}
+
+static indexed_queue_entry indexed_queue_top(const indexed_queue* queue)
+{
+   pre(queue->count > 0);
+
+   return queue->heap[0];
+}
+
+// Takes the handle out wherever it is in the heap, false when it was not queued
+static bool indexed_queue_remove(indexed_queue* queue, u32 handle)
+{
+   pre(handle < queue->handle_count);
+
+   u32 i = queue->position[handle];
+   if(i == indexed_queue_null)
+      return false;
+
+   queue->position[handle] = indexed_queue_null;
+
+   // the last entry refills the hole
+   if(i != --queue->count)
+      indexed_queue_sift(queue, i, queue->heap[queue->count]);
+
+   indexed_queue_check(queue);
+
+   return true;
+}
+
+static indexed_queue_entry indexed_queue_pop(indexed_queue* queue)
+{
+   pre(queue->count > 0);
+
+   indexed_queue_entry result = queue->heap[0];
+   indexed_queue_remove(queue, result.handle);
+
+   return result;
+}
+
+// Empties the queue, touching only the handles that were queued
+static void indexed_queue_clear(indexed_queue* queue)
+{
+   for(u32 i = 0; i < queue->count; ++i)
+      queue->position[queue->heap[i].handle] = indexed_queue_null;
+
+   queue->count = 0;
+}
+
+#endif
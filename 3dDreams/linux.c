@@ -0,0 +1,139 @@
+#if !defined(__linux__)
+#error "Cannot include the file on a non-Linux platforms"
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "common.h"
+#include "arena.h"
+
+// no native window yet, the platform runs headless
+align_struct hw_window
+{
+   void* (*open)(const char* title, int x, int y, int width, int height);
+   void (*close)(struct hw_window window);
+   void* handle;
+} hw_window;
+
+static void debug_message(const char* format, ...)
+{
+   va_list args;
+   va_start(args, format);
+   vfprintf(stderr, format, args);
+   va_end(args);
+}
+
+#include "hw.c"
+#include "linux_memory.c"
+
+static volatile sig_atomic_t global_quit_requested = 0;
+
+static void linux_sleep(u32 ms)
+{
+   struct timespec ts;
+   ts.tv_sec = ms / 1000;
+   ts.tv_nsec = (long)(ms % 1000) * 1000000;
+   nanosleep(&ts, 0);
+}
+
+static u32 linux_time()
+{
+   static u64 sys_time_base = 0;
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   const u64 now = (u64)ts.tv_sec*1000 + (u64)ts.tv_nsec/1000000;
+   if(sys_time_base == 0) sys_time_base = now;
+   return (u32)(now - sys_time_base);
+}
+
+static void linux_signal(int signal)
+{
+   global_quit_requested = 1;
+}
+
+static bool linux_platform_loop()
+{
+   return !global_quit_requested;
+}
+
+static void* linux_window_open(const char* title, int x, int y, int width, int height)
+{
+   static struct { int x, y, width, height; } headless_window;
+
+   headless_window.x = x;
+   headless_window.y = y;
+   headless_window.width = width;
+   headless_window.height = height;
+
+   debug_message("Opened headless window '%s' %dx%d\n", title, width, height);
+
+   return &headless_window;
+}
+
+static void linux_window_close(hw_window window)
+{
+   global_quit_requested = 1;
+}
+
+// No vulkan surface on this platform yet, run without a renderer backend
+bool vulkan_initialize(hw* hw)
+{
+   hw->renderer.frame_present = 0;
+   return true;
+}
+
+bool vulkan_deinitialize(hw* hw)
+{
+   return true;
+}
+
+int main(int argc, char** argv)
+{
+   const size virtual_memory_amount = default_arena_size;
+   hw hw = {0};
+
+   hw_virtual_memory_init();
+
+   // storage grows on demand, scratch stays small
+   hw.vulkan_storage = arena_new_growable(default_arena_reserve, virtual_memory_amount, ARENA_HUGE_PAGES);
+   hw.vulkan_scratch = arena_new(virtual_memory_amount, 0);
+
+   // without the per thread scratch pair scratch_get would hand out empty arenas
+   if(!hw.vulkan_storage.header || !hw.vulkan_scratch.header || !scratch_thread_create(virtual_memory_amount))
+   {
+      debug_message("Could not reserve the arenas\n");
+      arena_free(&hw.vulkan_storage);
+      arena_free(&hw.vulkan_scratch);
+      return 1;
+   }
+
+   hw.renderer.window.open = linux_window_open;
+   hw.renderer.window.close = linux_window_close;
+
+   hw.timer.sleep = linux_sleep;
+   hw.timer.time = linux_time;
+
+   hw.platform_loop = linux_platform_loop;
+
+   signal(SIGINT, linux_signal);
+   signal(SIGTERM, linux_signal);
+
+   // skip the program name like the win32 command line does
+   app_start(argc - 1, (const char**)argv + 1, &hw);
+
+#if defined(ARENA_TELEMETRY)
+   arena_stats_dump(&hw.vulkan_storage, "storage", debug_message);
+   arena_stats_dump(&hw.vulkan_scratch, "scratch", debug_message);
+#endif
+
+   arena_free(&hw.vulkan_storage);
+   arena_free(&hw.vulkan_scratch);
+   scratch_thread_release();
+
+   return 0;
+}
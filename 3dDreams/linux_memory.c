@@ -0,0 +1,217 @@
+#if !defined(__linux__)
+#error "Cannot include the file on a non-Linux platforms"
+#endif
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "arena.h"
+
+enum { HW_HUGE_PAGE_SIZE = 2*1024*1024 };
+
+static usize global_page_size = 0;
+
+static void* hw_virtual_memory_reserve(usize size)
+{
+   // let the os decide into what address to place the reserve
+   void* result = mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+   return result == MAP_FAILED ? 0 : result;
+}
+
+// Reserves a huge page aligned range, size must be a multiple of the huge page size.
+// Explicit huge pages come from the hugetlb pool whole, only arenas committed up front ask for them
+static void* hw_virtual_memory_reserve_huge(usize size, bool explicit_pages)
+{
+   pre((size & (HW_HUGE_PAGE_SIZE - 1)) == 0);
+
+#if defined(MAP_HUGETLB)
+   // explicit huge pages fail up front when the pool is too small, so no MAP_NORESERVE here
+   if(explicit_pages)
+   {
+      void* result = mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if(result != MAP_FAILED)
+         return result;
+   }
+#endif
+
+#if defined(MADV_HUGEPAGE)
+   // otherwise over reserve to align the range and ask for transparent huge pages
+   byte* base = hw_virtual_memory_reserve(size + HW_HUGE_PAGE_SIZE);
+   if(!base)
+      return 0;
+
+   byte* aligned = (byte*)(((uptr)base + HW_HUGE_PAGE_SIZE - 1) & ~((uptr)HW_HUGE_PAGE_SIZE - 1));
+   byte* end = base + size + HW_HUGE_PAGE_SIZE;
+
+   // trim the slack on both sides
+   if(aligned > base)
+      munmap(base, aligned - base);
+   if(end > aligned + size)
+      munmap(aligned + size, end - (aligned + size));
+
+   if(madvise(aligned, size, MADV_HUGEPAGE) != 0)
+   {
+      munmap(aligned, size);
+      return 0;
+   }
+
+   return aligned;
+#else
+   return 0;
+#endif
+}
+
+static bool hw_virtual_memory_commit(void* address, usize size)
+{
+   pre(((uptr)address & (global_page_size - 1)) == 0);
+
+   // pages are backed lazily by the kernel on first touch
+   return mprotect(address, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+static void hw_virtual_memory_release(void* address, usize size)
+{
+   munmap(address, size);
+}
+
+static void hw_virtual_memory_decommit(void* address, usize size)
+{
+   pre(((uptr)address & (global_page_size - 1)) == 0);
+
+   // give the physical pages back and keep the address range reserved
+   madvise(address, size, MADV_DONTNEED);
+   mprotect(address, size, PROT_NONE);
+}
+
+static void hw_virtual_memory_init()
+{
+   global_page_size = (usize)sysconf(_SC_PAGESIZE);
+
+   post(global_page_size > 0);
+   post((global_page_size & (global_page_size - 1)) == 0);
+}
+
+static arena arena_new(size cap, u32 flags)
+{
+   arena a = {}; // stub arena
+   if(cap <= (size)sizeof(arena_header))
+      return a;
+
+   byte* base = 0;
+   u32 granted = 0;
+
+   if(flags & ARENA_HUGE_PAGES)
+   {
+      const size huge_cap = (cap + HW_HUGE_PAGE_SIZE - 1) & ~(size)(HW_HUGE_PAGE_SIZE - 1);
+      base = hw_virtual_memory_reserve_huge(huge_cap, true);
+      if(base)
+      {
+         cap = huge_cap;
+         granted |= ARENA_HUGE_PAGES;
+      }
+   }
+
+   // fall back to normal pages
+   if(!base)
+      base = hw_virtual_memory_reserve(cap);
+   if(!base)
+      return a;
+
+   if(!hw_virtual_memory_commit(base, cap))
+   {
+      hw_virtual_memory_release(base, cap);
+      return a;
+   }
+
+   // fully committed up front
+   arena_header* header = (arena_header*)base;
+   header->commit = base + cap;
+   header->end = base + cap;
+   header->chunk = 0;
+   header->peak = arena_first(header);
+   header->flags = granted;
+
+   // set the base pointer and size on success
+   a.header = header;
+   a.beg = arena_first(header);
+   a.end = header->end;
+
+   return a;
+}
+
+// reserves the whole range but only commits chunk sized pieces as the arena grows
+static arena arena_new_growable(size reserve, size chunk, u32 flags)
+{
+   arena a = {}; // stub arena
+   if(reserve <= (size)sizeof(arena_header) || chunk <= 0)
+      return a;
+
+   byte* base = 0;
+   u32 granted = 0;
+
+   if(flags & ARENA_HUGE_PAGES)
+   {
+      const size huge_reserve = (reserve + HW_HUGE_PAGE_SIZE - 1) & ~(size)(HW_HUGE_PAGE_SIZE - 1);
+      // transparent huge pages only, a hugetlb mapping would take the whole reserve from the pool
+      base = hw_virtual_memory_reserve_huge(huge_reserve, false);
+      if(base)
+      {
+         reserve = huge_reserve;
+         granted |= ARENA_HUGE_PAGES;
+      }
+   }
+
+   // huge pages are committed whole, normal ones page by page
+   const usize granularity = (granted & ARENA_HUGE_PAGES) ? HW_HUGE_PAGE_SIZE : global_page_size;
+   chunk = (chunk + granularity - 1) & ~(granularity - 1);
+   const size first = chunk < reserve ? chunk : reserve;
+
+   // fall back to normal pages
+   if(!base)
+      base = hw_virtual_memory_reserve(reserve);
+   if(!base)
+      return a;
+
+   // the first chunk holds the header
+   if(!hw_virtual_memory_commit(base, first))
+   {
+      hw_virtual_memory_release(base, reserve);
+      return a;
+   }
+
+   arena_header* header = (arena_header*)base;
+   header->commit = base + first;
+   header->end = base + reserve;
+   header->chunk = chunk;
+   header->peak = arena_first(header);
+   header->flags = granted;
+
+   a.header = header;
+   a.beg = arena_first(header);
+   a.end = header->end;
+
+   return a;
+}
+
+bool arena_pages_commit(void* address, size bytes)
+{
+   return hw_virtual_memory_commit(address, bytes);
+}
+
+void arena_pages_decommit(void* address, size bytes)
+{
+   hw_virtual_memory_decommit(address, bytes);
+}
+
+static void arena_free(arena* a)
+{
+   arena_header* header = a->header;
+   if(!header)
+      return;
+
+   hw_virtual_memory_release(header, header->end - (byte*)header);
+
+   *a = (arena){0};
+}
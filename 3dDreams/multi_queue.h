@@ -0,0 +1,255 @@
+#if !defined(_MULTI_QUEUE_H)
+#define _MULTI_QUEUE_H
+
+#include "common.h"
+#include "arena.h"
+#include "atomic.h"
+
+// Relaxed concurrent priority queue for the job system, a MultiQueue. The entries are spread
+// over more spinlocked 4-ary heaps than there are threads. Push goes to a random shard, pop
+// takes the better top of two random shards, so threads rarely meet on a lock and the popped
+// key is close to the smallest one instead of exactly it. Any thread may push and pop.
+// Pop can miss entries pushed while it looks, it only fails after a scan found every shard empty.
+
+#define multi_queue_empty_key ((u64)-1)   // cached top of an empty shard
+
+enum { MULTI_QUEUE_ARITY_SHIFT = 2, MULTI_QUEUE_ATTEMPTS = 8, MULTI_QUEUE_SPINS = 64 };
+
+#define multi_queue_parent(i)    (((i) - 1) >> MULTI_QUEUE_ARITY_SHIFT)
+#define multi_queue_child(i)     (((i) << MULTI_QUEUE_ARITY_SHIFT) + 1)
+
+// Smallest key first, value is a job index or pointer
+typedef struct multi_queue_entry
+{
+   u64 key;
+   u64 value;
+} multi_queue_entry;
+
+// one cache line each so threads on different shards do not share lines
+align_struct multi_queue_shard
+{
+   volatile u32 lock;
+   u32 count;
+   u32 capacity;
+   volatile u64 top;          // key of the smallest entry, read without the lock
+   multi_queue_entry* heap;
+} multi_queue_shard;
+
+typedef struct multi_queue
+{
+   multi_queue_shard* shards;
+   u32 shard_count;
+} multi_queue;
+
+static thread_local_storage u32 multi_queue_random_state;
+
+// xorshift per thread, seeded from the address of its own state so every thread differs
+static u32 multi_queue_random()
+{
+   u32 x = multi_queue_random_state;
+   if(x == 0)
+      x = (u32)(((u64)(uptr)&multi_queue_random_state * 0x9e3779b97f4a7c15ull) >> 32) | 1;
+
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   multi_queue_random_state = x;
+
+   return x;
+}
+
+static bool multi_queue_try_lock(multi_queue_shard* shard)
+{
+   // test before the exchange so waiting threads do not bounce the line around
+   return atomic_load_u32(&shard->lock) == 0 && atomic_exchange_u32(&shard->lock, 1) == 0;
+}
+
+// Spins a little, then yields between tries. With more threads than cores the holder may be
+// preempted and a spinning waiter would burn its whole time slice
+static void multi_queue_lock(multi_queue_shard* shard)
+{
+   for(u32 spin = 1; !multi_queue_try_lock(shard); ++spin)
+   {
+      if(spin % MULTI_QUEUE_SPINS)
+         atomic_pause();
+      else
+         atomic_yield();
+   }
+}
+
+static void multi_queue_unlock(multi_queue_shard* shard)
+{
+   atomic_store_u32(&shard->lock, 0);
+}
+
+// Use about twice as many shards as threads. Every shard holds up to shard_capacity entries.
+// False when the arena is out of memory
+static bool multi_queue_init(multi_queue* queue, arena* a, u32 shard_count, u32 shard_capacity)
+{
+   pre(shard_count > 0 && shard_capacity > 0);
+
+   queue->shards = new(a, multi_queue_shard, shard_count);
+   if(arena_end(a, queue->shards))
+      return false;
+
+   for(u32 i = 0; i < shard_count; ++i)
+   {
+      multi_queue_shard* shard = queue->shards + i;
+
+      shard->heap = new(a, multi_queue_entry, shard_capacity);
+      if(arena_end(a, shard->heap))
+         return false;
+
+      shard->lock = 0;
+      shard->count = 0;
+      shard->capacity = shard_capacity;
+      shard->top = multi_queue_empty_key;
+   }
+
+   queue->shard_count = shard_count;
+
+   return true;
+}
+
+// Heap of one shard, the caller holds its lock
+static void multi_queue_shard_push(multi_queue_shard* shard, multi_queue_entry entry)
+{
+   pre(shard->count < shard->capacity);
+
+   u32 i = shard->count++;
+   while(i > 0)
+   {
+      u32 parent = multi_queue_parent(i);
+      if(shard->heap[parent].key <= entry.key)
+         break;
+
+      shard->heap[i] = shard->heap[parent];
+      i = parent;
+   }
+   shard->heap[i] = entry;
+
+   atomic_store_u64(&shard->top, shard->heap[0].key);
+}
+
+static multi_queue_entry multi_queue_shard_pop(multi_queue_shard* shard)
+{
+   pre(shard->count > 0);
+
+   multi_queue_entry result = shard->heap[0];
+   multi_queue_entry last = shard->heap[--shard->count];
+   const u32 count = shard->count;
+
+   u32 i = 0;
+   for(;;)
+   {
+      u32 first = multi_queue_child(i);
+      if(first >= count)
+         break;
+
+      u32 end = first + (1u << MULTI_QUEUE_ARITY_SHIFT) < count ? first + (1u << MULTI_QUEUE_ARITY_SHIFT) : count;
+      u32 best = first;
+      for(u32 c = first + 1; c < end; ++c)
+         if(shard->heap[c].key < shard->heap[best].key)
+            best = c;
+
+      if(shard->heap[best].key >= last.key)
+         break;
+
+      shard->heap[i] = shard->heap[best];
+      i = best;
+   }
+   if(count > 0)
+      shard->heap[i] = last;
+
+   atomic_store_u64(&shard->top, count > 0 ? shard->heap[0].key : multi_queue_empty_key);
+
+   return result;
+}
+
+// False only when every shard is full, the key must be below multi_queue_empty_key
+static bool multi_queue_push(multi_queue* queue, u64 key, u64 value)
+{
+   pre(key != multi_queue_empty_key);
+
+   multi_queue_entry entry = {key, value};
+
+   // random shards that are free right now
+   for(u32 attempt = 0; attempt < MULTI_QUEUE_ATTEMPTS; ++attempt)
+   {
+      multi_queue_shard* shard = queue->shards + multi_queue_random() % queue->shard_count;
+      if(!multi_queue_try_lock(shard))
+         continue;
+
+      bool room = shard->count < shard->capacity;
+      if(room)
+         multi_queue_shard_push(shard, entry);
+      multi_queue_unlock(shard);
+
+      if(room)
+         return true;
+   }
+
+   // crowded or nearly full, wait on every shard in turn from a random start
+   u32 start = multi_queue_random() % queue->shard_count;
+   for(u32 i = 0; i < queue->shard_count; ++i)
+   {
+      multi_queue_shard* shard = queue->shards + (start + i) % queue->shard_count;
+      multi_queue_lock(shard);
+
+      bool room = shard->count < shard->capacity;
+      if(room)
+         multi_queue_shard_push(shard, entry);
+      multi_queue_unlock(shard);
+
+      if(room)
+         return true;
+   }
+
+   return false;
+}
+
+// Takes an entry with one of the smallest keys, false when the queue looked empty
+static bool multi_queue_pop(multi_queue* queue, multi_queue_entry* entry)
+{
+   for(u32 attempt = 0; attempt < MULTI_QUEUE_ATTEMPTS; ++attempt)
+   {
+      multi_queue_shard* a = queue->shards + multi_queue_random() % queue->shard_count;
+      multi_queue_shard* b = queue->shards + multi_queue_random() % queue->shard_count;
+
+      // the tops may be stale, the lock settles it
+      multi_queue_shard* shard = atomic_load_u64(&a->top) <= atomic_load_u64(&b->top) ? a : b;
+      if(atomic_load_u64(&shard->top) == multi_queue_empty_key || !multi_queue_try_lock(shard))
+         continue;
+
+      bool found = shard->count > 0;
+      if(found)
+         *entry = multi_queue_shard_pop(shard);
+      multi_queue_unlock(shard);
+
+      if(found)
+         return true;
+   }
+
+   // mostly empty or crowded, take the first entry of any shard
+   u32 start = multi_queue_random() % queue->shard_count;
+   for(u32 i = 0; i < queue->shard_count; ++i)
+   {
+      multi_queue_shard* shard = queue->shards + (start + i) % queue->shard_count;
+      if(atomic_load_u64(&shard->top) == multi_queue_empty_key)
+         continue;
+
+      multi_queue_lock(shard);
+
+      bool found = shard->count > 0;
+      if(found)
+         *entry = multi_queue_shard_pop(shard);
+      multi_queue_unlock(shard);
+
+      if(found)
+         return true;
+   }
+
+   return false;
+}
+
+#endif
@@ -0,0 +1,136 @@
+#if !defined(_POOL_H)
+#define _POOL_H
+
+#include "common.h"
+#include "arena.h"
+
+// Fixed size object pool carved from an arena with O(1) alloc and free.
+// Handles stay stable for the life of the object and the slot generation
+// catches handles to objects that were freed and reused.
+
+#define pool_null_index ((u32)-1)
+
+#define pool_new(a, t, n)     pool_create(a, sizeof(t), __alignof(t), n)
+#define pool_get(p, t, h)     ((t*)pool_lookup((p), (h)))
+#define pool_is_full(p)       ((p)->free_head == pool_null_index && (p)->used == (p)->capacity)
+#define pool_handle_null(h)   ((h).index == pool_null_index)
+
+typedef struct pool_handle
+{
+   u32 index;
+   u32 generation;   // odd while the slot is alive
+} pool_handle;
+
+typedef struct pool
+{
+   byte* slots;
+   u32* generations;
+   u32* next_free;
+   size slot_size;
+   u32 capacity;
+   u32 used;         // slots handed out atleast once
+   u32 count;        // slots alive
+   u32 free_head;
+} pool;
+
+static pool pool_create(arena* a, size slot_size, size align, u32 capacity)
+{
+   pool result = {0};
+   pre(slot_size > 0 && capacity > 0);
+
+   // keep every slot aligned
+   slot_size = (slot_size + (align - 1)) & (-align);
+
+   byte* slots = alloc(a, slot_size, align, capacity, 0);
+   if(arena_end(a, slots))
+      return result;
+
+   u32* generations = new(a, u32, capacity);
+   u32* next_free = new(a, u32, capacity);
+   if(arena_end(a, generations) || arena_end(a, next_free))
+      return result;
+
+   memset(generations, 0, capacity*sizeof(u32));
+
+   result.slots = slots;
+   result.generations = generations;
+   result.next_free = next_free;
+   result.slot_size = slot_size;
+   result.capacity = capacity;
+   result.free_head = pool_null_index;
+
+   return result;
+}
+
+// Returns a null handle when the pool is full, the slot is zeroed
+static pool_handle pool_alloc(pool* p)
+{
+   pool_handle result = {pool_null_index, 0};
+   u32 index;
+
+   if(p->free_head != pool_null_index)
+   {
+      index = p->free_head;
+      p->free_head = p->next_free[index];
+   }
+   else if(p->used < p->capacity)
+      index = p->used++;
+   else
+      return result;
+
+   pre((p->generations[index] & 1) == 0);
+
+   p->generations[index]++;
+   p->count++;
+
+   memset(p->slots + index*p->slot_size, 0, p->slot_size);
+
+   result.index = index;
+   result.generation = p->generations[index];
+
+   post(result.generation & 1);
+
+   return result;
+}
+
+static bool pool_valid(const pool* p, pool_handle h)
+{
+   return h.index < p->used && p->generations[h.index] == h.generation && (h.generation & 1);
+}
+
+// Returns zero for stale or null handles
+static void* pool_lookup(const pool* p, pool_handle h)
+{
+   if(!pool_valid(p, h))
+      return 0;
+
+   return p->slots + h.index*p->slot_size;
+}
+
+static void pool_free(pool* p, pool_handle h)
+{
+   pre(pool_valid(p, h));
+   if(!pool_valid(p, h))
+      return;
+
+   // even generation marks the slot free and invalidates outstanding handles
+   p->generations[h.index]++;
+   p->next_free[h.index] = p->free_head;
+   p->free_head = h.index;
+   p->count--;
+
+   post(!pool_valid(p, h));
+}
+
+static void pool_clear(pool* p)
+{
+   // bump every live slot to the next even generation
+   for(u32 i = 0; i < p->used; ++i)
+      p->generations[i] += p->generations[i] & 1;
+
+   p->used = 0;
+   p->count = 0;
+   p->free_head = pool_null_index;
+}
+
+#endif
@@ -1,9 +1,19 @@
 #if !defined(_PRIORITY_QUEUE_H)
 #define _PRIORITY_QUEUE_H
 
+#include <string.h>
 #include "common.h"
-#include <assert.h>
-
+#include "arena.h"
+
+// Implicit d-ary heap, the arity is a power of two picked per queue so the index math is shifts.
+// Wider heaps are shallower and the children of a node share cache lines, which pays off once the
+// queue outgrows the cache. Define before including:
+//
+//    priority_queue_type           element type
+//    priority_queue_max_count      optional, capacity of an element array inside the queue.
+//                                  Without it the elements live in an arena and grow on demand
+//    priority_queue_before(a, b)   optional, true if a leaves the queue before b, the smallest index first by default
+//    PRIORITY_QUEUE_CHECK          optional, checks the whole heap after every operation in debug builds
 #if 0
 typedef struct priority_queue_node
 {
@@ -13,146 +23,225 @@ typedef struct priority_queue_node
 
 #define priority_queue_type priority_queue_node
 #define priority_queue_max_count 4096
+#define priority_queue_before(a, b) ((a).index > (b).index) // max heap
 #include "priority_queue.h"
 #endif
 
-#define priority_queue_lc(i) (2*(i))+1
-#define priority_queue_rc(i) (2*(i))+2
-#define priority_queue_root(i) (usize)(((f32)(i)/2.0f)-0.5f)
+#if !defined(priority_queue_before)
+#define priority_queue_before(a, b) ((a).index < (b).index)
+#endif
 
-typedef enum priority_queue_criteria
-{
-   PRIORITY_QUEUE_CRITERIA_MAX, PRIORITY_QUEUE_CRITERIA_MIN
-} priority_queue_criteria;
+#if defined(PRIORITY_QUEUE_CHECK)
+#define priority_queue_check(q) inv(priority_queue_invariant(q))
+#else
+#define priority_queue_check(q)
+#endif
+
+#define priority_queue_parent(q, i)    (((i) - 1) >> (q)->shift)
+#define priority_queue_child(q, i)     (((i) << (q)->shift) + 1)
+#define priority_queue_empty(q)        ((q)->count == 0)
+
+#define priority_queue_shift(arity)    ((arity) == 2 ? 1 : (arity) == 4 ? 2 : 3)
+
+#if defined(priority_queue_max_count)
+#define priority_queue_full(q)         ((q)->count == priority_queue_max_count)
 
 typedef struct priority_queue
 {
    priority_queue_type elements[priority_queue_max_count];
-   priority_queue_criteria criteria;
    usize count;
+   u32 shift;        // log2 of the arity
 } priority_queue;
 
-static void priority_queue_swap(priority_queue_type* a, priority_queue_type* b)
+// Arity of 2, 4 or 8
+static void priority_queue_init(priority_queue* queue, u32 arity)
 {
-   priority_queue_type t;
-   t = *b;
-   *b = *a;
-   *a = t;
+   pre(arity == 2 || arity == 4 || arity == 8);
+
+   queue->count = 0;
+   queue->shift = priority_queue_shift(arity);
 }
 
-static bool priority_queue_invariant(priority_queue* queue)
+// The fixed array never grows
+static bool priority_queue_reserve(priority_queue* queue, usize count)
+{
+   (void)queue;
+
+   return count <= priority_queue_max_count;
+}
+#else
+#define priority_queue_full(q)         ((q)->count == (q)->capacity)
+
+typedef struct priority_queue
+{
+   priority_queue_type* elements;
+   usize count;
+   usize capacity;
+   arena* storage;   // the elements grow in here, must outlive the queue
+   u32 shift;        // log2 of the arity
+} priority_queue;
+
+// Makes room for count elements. While the elements are the last allocation of the arena they
+// grow in place, a growable arena just commits more pages. Otherwise they move to a new block
+// of twice the size and the old one stays behind until the arena is rewound
+static bool priority_queue_reserve(priority_queue* queue, usize count)
 {
-   usize root, lc, rc;
-   usize i;
+   if(count <= queue->capacity)
+      return true;
 
-   for(i = 0; i < queue->count; ++i)
+   arena* a = queue->storage;
+   usize capacity = queue->capacity*2 > count ? queue->capacity*2 : count;
+
+   if(queue->elements && (byte*)(queue->elements + queue->capacity) == a->beg)
+   {
+      priority_queue_type* tail = new(a, priority_queue_type, capacity - queue->capacity);
+      if(arena_end(a, tail))
+         return false;
+
+      post(tail == queue->elements + queue->capacity);
+   }
+   else
    {
-      if(priority_queue_rc(i) < queue->count)
-      {
-         root = queue->elements[i].index;
-         lc = queue->elements[priority_queue_lc(i)].index;
-         rc = queue->elements[priority_queue_rc(i)].index;
-
-         if(queue->criteria == PRIORITY_QUEUE_CRITERIA_MAX)
-            if(root < lc || root < rc)
-               return false;
-         if(queue->criteria == PRIORITY_QUEUE_CRITERIA_MIN)
-            if(root > lc || root > rc)
-               return false;
-      }
-      else break;
+      priority_queue_type* elements = new(a, priority_queue_type, capacity);
+      if(arena_end(a, elements))
+         return false;
+
+      if(queue->count > 0)
+         memcpy(elements, queue->elements, queue->count*sizeof(priority_queue_type));
+      queue->elements = elements;
    }
 
+   queue->capacity = capacity;
+
    return true;
 }
 
-static void priority_queue_insert(priority_queue* queue, priority_queue_type data)
+// Arity of 2, 4 or 8, capacity is only the first allocation. False when the arena is out of memory
+static bool priority_queue_init(priority_queue* queue, arena* a, u32 arity, usize capacity)
 {
-   // indexes
-   usize parent, child;
-   // min/max heap
-   const bool is_max = queue->criteria == PRIORITY_QUEUE_CRITERIA_MAX;
+   pre(arity == 2 || arity == 4 || arity == 8);
 
-   assert(priority_queue_invariant(queue));
-   pre(queue->count < priority_queue_max_count);
+   queue->elements = 0;
+   queue->count = 0;
+   queue->capacity = 0;
+   queue->storage = a;
+   queue->shift = priority_queue_shift(arity);
+
+   return capacity == 0 || priority_queue_reserve(queue, capacity);
+}
+#endif
 
-   queue->count++;
-   queue->elements[queue->count - 1] = data;
+// O(n), only for checks
+static bool priority_queue_invariant(const priority_queue* queue)
+{
+   for(usize i = 1; i < queue->count; ++i)
+      if(priority_queue_before(queue->elements[i], queue->elements[priority_queue_parent(queue, i)]))
+         return false;
 
-   child = queue->count - 1;
-   parent = priority_queue_root(child);
+   return true;
+}
 
-   while(parent >= 0)
+// Moves the hole at i up until data fits, shifting parents down instead of swapping
+static void priority_queue_sift_up(priority_queue* queue, usize i, priority_queue_type data)
+{
+   while(i > 0)
    {
-      if(is_max)
-         if(queue->elements[parent].index < queue->elements[child].index)
-         {
-            priority_queue_swap(&queue->elements[parent], &queue->elements[child]);
-            child = parent;
-            parent = priority_queue_root(parent);
-         }
-         else break;
-      if(!is_max)
-         if(queue->elements[parent].index > queue->elements[child].index)
-         {
-            priority_queue_swap(&queue->elements[parent], &queue->elements[child]);
-            child = parent;
-            parent = priority_queue_root(parent);
-         }
-         else break;
+      usize parent = priority_queue_parent(queue, i);
+      if(!priority_queue_before(data, queue->elements[parent]))
+         break;
+
+      queue->elements[i] = queue->elements[parent];
+      i = parent;
    }
 
-   assert(priority_queue_invariant(queue));
+   queue->elements[i] = data;
 }
 
-static priority_queue_type priority_queue_remove(priority_queue* queue)
+// Moves the hole at i down past every child that leaves before data
+static void priority_queue_sift_down(priority_queue* queue, usize i, priority_queue_type data)
 {
-   priority_queue_type result;
-   // indexes
-   usize parent, child;
-   // min/max heap
-   const bool is_max = queue->criteria == PRIORITY_QUEUE_CRITERIA_MAX;
+   const usize count = queue->count;
+   const usize arity = (usize)1 << queue->shift;
 
-   assert(priority_queue_invariant(queue));
-   pre(queue->count > 0);
+   for(;;)
+   {
+      usize first = priority_queue_child(queue, i);
+      if(first >= count)
+         break;
 
-   result = queue->elements[0];
-   queue->elements[0] = queue->elements[queue->count - 1];
-   queue->count--;
-   parent = 0;
-   child = 1;
+      usize last = first + arity < count ? first + arity : count;
+      usize best = first;
+      for(usize c = first + 1; c < last; ++c)
+         if(priority_queue_before(queue->elements[c], queue->elements[best]))
+            best = c;
 
-   while(child + 1 < queue->count)
-   {
-      if(is_max)
-      {
-         if(queue->elements[child].index < queue->elements[child + 1].index)
-            child = child + 1;
-         if(queue->elements[child].index > queue->elements[parent].index)
-         {
-            priority_queue_swap(&queue->elements[parent], &queue->elements[child]);
-            parent = child;
-            child = priority_queue_lc(child);
-         }
-         else break;
-      }
-      if(!is_max)
-      {
-         if(queue->elements[child].index > queue->elements[child + 1].index)
-            child = child + 1;
-         if(queue->elements[child].index < queue->elements[parent].index)
-         {
-            priority_queue_swap(&queue->elements[parent], &queue->elements[child]);
-            parent = child;
-            child = priority_queue_lc(child);
-         }
-         else break;
-      }
+      if(!priority_queue_before(queue->elements[best], data))
+         break;
+
+      queue->elements[i] = queue->elements[best];
+      i = best;
    }
 
-   assert(priority_queue_invariant(queue));
+   queue->elements[i] = data;
+}
+
+// False only when the queue is full and cannot grow
+static bool priority_queue_insert(priority_queue* queue, priority_queue_type data)
+{
+   pre(queue->shift > 0);
+
+   if(!priority_queue_reserve(queue, queue->count + 1))
+      return false;
+
+   priority_queue_sift_up(queue, queue->count++, data);
+
+   priority_queue_check(queue);
+
+   return true;
+}
+
+static priority_queue_type priority_queue_top(const priority_queue* queue)
+{
+   pre(queue->count > 0);
+
+   return queue->elements[0];
+}
+
+static priority_queue_type priority_queue_remove(priority_queue* queue)
+{
+   pre(queue->shift > 0);
+   pre(queue->count > 0);
+
+   priority_queue_type result = queue->elements[0];
+
+   // the last element refills the root hole
+   if(--queue->count > 0)
+      priority_queue_sift_down(queue, 0, queue->elements[queue->count]);
+
+   priority_queue_check(queue);
 
    return result;
 }
 
+// Replaces the contents with count elements in O(n), sifting down every parent from the last one up.
+// False when they do not fit
+static bool priority_queue_heapify(priority_queue* queue, const priority_queue_type* data, usize count)
+{
+   pre(queue->shift > 0);
+
+   if(!priority_queue_reserve(queue, count))
+      return false;
+
+   memcpy(queue->elements, data, count*sizeof(priority_queue_type));
+   queue->count = count;
+
+   if(count > 1)
+      for(usize i = priority_queue_parent(queue, count - 1) + 1; i-- > 0;)
+         priority_queue_sift_down(queue, i, queue->elements[i]);
+
+   priority_queue_check(queue);
+
+   return true;
+}
+
 #endif
@@ -0,0 +1,137 @@
+#if !defined(_RADIX_SORT_H)
+#define _RADIX_SORT_H
+
+#include "common.h"
+#include "arena.h"
+
+// Stable least significant digit radix sort of integer keys with an optional u32 payload each,
+// for draw sort keys and LOD or streaming priorities. 11 bit digits, three passes for 32 bit keys
+// and six for 64 bit ones, with all the histograms gathered in a single read up front. Passes
+// where every key has the same digit are skipped. Keys and payloads travel as one pair between
+// passes, so every element is a single store. The buffers come from the scratch arena.
+
+enum { RADIX_SORT_BITS = 11, RADIX_SORT_BUCKETS = 1 << RADIX_SORT_BITS };
+
+#define radix_sort_digit(k, pass) (u32)(((k) >> ((pass)*RADIX_SORT_BITS)) & (RADIX_SORT_BUCKETS - 1))
+#define radix_sort_pass_count(key_type) ((i32)(sizeof(key_type)*8 + RADIX_SORT_BITS - 1) / RADIX_SORT_BITS)
+
+// Turns the counts of one pass into bucket offsets, false when every key has the same digit
+// and the pass would only copy
+static bool radix_sort_offsets(u32 offsets[RADIX_SORT_BUCKETS], u32 count)
+{
+   u32 sum = 0;
+   for(i32 b = 0; b < RADIX_SORT_BUCKETS; ++b)
+   {
+      u32 n = offsets[b];
+      if(n == count)
+         return false;
+
+      offsets[b] = sum;
+      sum += n;
+   }
+
+   return true;
+}
+
+// Defines name(keys, values, count, scratch) for one key type. Sorts the keys ascending in place
+// and moves values along when not zero. False when the scratch is too small
+#define radix_sort_define(name, key_type) \
+   typedef struct name##_pair { key_type key; u32 value; } name##_pair; \
+   \
+   static bool name(key_type* keys, u32* values, size count, arena scratch) \
+   { \
+      enum { pass_count = radix_sort_pass_count(key_type) }; \
+      pre(count >= 0 && count <= (size)0xffffffffu); \
+      \
+      if(count < 2) \
+         return true; \
+      \
+      u32 histogram[pass_count][RADIX_SORT_BUCKETS] = {0}; \
+      for(size i = 0; i < count; ++i) \
+         for(i32 pass = 0; pass < pass_count; ++pass) \
+            histogram[pass][radix_sort_digit(keys[i], pass)]++; \
+      \
+      i32 passes[pass_count]; \
+      i32 active = 0; \
+      for(i32 pass = 0; pass < pass_count; ++pass) \
+         if(radix_sort_offsets(histogram[pass], (u32)count)) \
+            passes[active++] = pass; \
+      \
+      if(active == 0) \
+         return true; \
+      \
+      if(!values) \
+      { \
+         key_type* buffer = new(&scratch, key_type, count); \
+         if(arena_end(&scratch, buffer)) \
+            return false; \
+         \
+         key_type* from = keys; \
+         key_type* to = buffer; \
+         for(i32 p = 0; p < active; ++p) \
+         { \
+            u32* offsets = histogram[passes[p]]; \
+            for(size i = 0; i < count; ++i) \
+               to[offsets[radix_sort_digit(from[i], passes[p])]++] = from[i]; \
+            \
+            key_type* t = from; from = to; to = t; \
+         } \
+         \
+         /* an odd number of passes leaves the result in the scratch copy */ \
+         if(from != keys) \
+            memcpy(keys, from, count*sizeof(key_type)); \
+         \
+         return true; \
+      } \
+      \
+      name##_pair* pairs = new(&scratch, name##_pair, count); \
+      name##_pair* other = active > 2 ? new(&scratch, name##_pair, count) : 0; \
+      if(arena_end(&scratch, pairs) || arena_end(&scratch, other)) \
+         return false; \
+      \
+      /* the first pass reads the arrays */ \
+      u32* offsets = histogram[passes[0]]; \
+      for(size i = 0; i < count; ++i) \
+      { \
+         name##_pair* to = pairs + offsets[radix_sort_digit(keys[i], passes[0])]++; \
+         to->key = keys[i]; \
+         to->value = values[i]; \
+      } \
+      \
+      for(i32 p = 1; p < active - 1; ++p) \
+      { \
+         offsets = histogram[passes[p]]; \
+         for(size i = 0; i < count; ++i) \
+            other[offsets[radix_sort_digit(pairs[i].key, passes[p])]++] = pairs[i]; \
+         \
+         name##_pair* t = pairs; pairs = other; other = t; \
+      } \
+      \
+      /* the last pass writes them back, with a single pass it only unpacks */ \
+      if(active == 1) \
+      { \
+         for(size i = 0; i < count; ++i) \
+         { \
+            keys[i] = pairs[i].key; \
+            values[i] = pairs[i].value; \
+         } \
+         return true; \
+      } \
+      \
+      offsets = histogram[passes[active - 1]]; \
+      for(size i = 0; i < count; ++i) \
+      { \
+         u32 slot = offsets[radix_sort_digit(pairs[i].key, passes[active - 1])]++; \
+         keys[slot] = pairs[i].key; \
+         values[slot] = pairs[i].value; \
+      } \
+      \
+      return true; \
+   }
+
+radix_sort_define(radix_sort_u32, u32)
+
+// The usual draw sort key
+radix_sort_define(radix_sort_u64, u64)
+
+#endif
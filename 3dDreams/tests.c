@@ -0,0 +1,1823 @@
+// Checked tests of the kernels that have a reference to hold them against, standalone and Linux only.
+//
+//    cc -std=gnu11 -O2 -ffp-contract=off -DUSE_SIMD tests.c -o tests -lpthread -lm
+//    ./tests [name filter]
+//
+// Prints one line per test and exits with 1 if any check failed. Build once more without USE_SIMD
+// to run the same checks on the scalar backend, and once with -DARENA_TELEMETRY to check the arena
+// counters too. The simd math is checked bit for bit against a scalar reference, so fused multiply
+// adds have to stay off.
+
+#if !defined(__linux__)
+#error "The tests run on Linux"
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "hw.h"
+#include "linux_memory.c"
+#include "graphics.h"
+#include "pool.h"
+#include "fixed_point.h"
+#include "bsp.h"
+#include "bvh.h"
+
+typedef struct test_node
+{
+   usize index;
+   u32 order;     // insertion order, to tell equal keys apart
+} test_node;
+
+#define priority_queue_type test_node
+#define PRIORITY_QUEUE_CHECK
+#include "priority_queue.h"
+
+#define INDEXED_QUEUE_CHECK
+#include "indexed_queue.h"
+#include "radix_sort.h"
+#include "bucket_queue.h"
+#include "multi_queue.h"
+
+static const char* test_filter = 0;
+static u32 test_failures;     // failed checks of the running test
+
+// Reports the first few failures of a test, later ones are only counted
+#define test_check(condition, ...) \
+   do \
+   { \
+      if(!(condition)) \
+      { \
+         if(test_failures++ < 8) \
+         { \
+            printf("   %s(%d): ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+         } \
+      } \
+   } while(0)
+
+// xorshift so every run checks the same inputs
+static u32 test_random_state = 0x2545f491;
+
+static u32 test_random()
+{
+   u32 x = test_random_state;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   test_random_state = x;
+
+   return x;
+}
+
+static f32 test_uniform(f32 lo, f32 hi)
+{
+   return lo + (hi - lo)*((f32)test_random() / (f32)0xffffffffu);
+}
+
+static bool test_run(const char* name, void (*function)(void))
+{
+   if(test_filter && !strstr(name, test_filter))
+      return true;
+
+   test_failures = 0;
+   function();
+
+   printf("%s %s", test_failures ? "FAIL" : "ok  ", name);
+   if(test_failures)
+      printf(", %u failed checks", test_failures);
+   printf("\n");
+   fflush(stdout);
+
+   return test_failures == 0;
+}
+
+enum { TEST_THREADS = 8, TEST_ALLOCS_PER_THREAD = 20000 };
+
+// One block handed out by alloc_atomic
+typedef struct test_block
+{
+   byte* p;
+   size bytes;
+   size align;
+} test_block;
+
+typedef struct test_thread
+{
+   arena* shared;
+   test_block* blocks;
+   size count;
+   u32 seed;
+   bool uniform;     // sizes and alignment of 16 only, so no padding
+} test_thread;
+
+static void* test_thread_alloc_atomic(void* p)
+{
+   test_thread* t = p;
+   u32 x = t->seed;
+
+   for(size i = 0; i < t->count; ++i)
+   {
+      x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+
+      size align = t->uniform ? 16 : (size)1 << (x % 7);
+      size bytes = t->uniform ? 16*(1 + (x >> 8) % 8) : 1 + (x >> 8) % 200;
+
+      t->blocks[i].p = alloc_atomic(t->shared, bytes, align, 1, 0);
+      t->blocks[i].bytes = bytes;
+      t->blocks[i].align = align;
+   }
+
+   return 0;
+}
+
+static int test_block_compare(const void* a, const void* b)
+{
+   const byte* x = ((const test_block*)a)->p;
+   const byte* y = ((const test_block*)b)->p;
+
+   return x < y ? -1 : x > y;
+}
+
+// Threads bump one arena at once, then the blocks have to tile it without overlap
+static void test_alloc_atomic_run(bool uniform)
+{
+   enum { count = TEST_THREADS*TEST_ALLOCS_PER_THREAD };
+
+   arena shared = arena_new(MB(64), 0);
+   arena blocks_arena = arena_new(count*sizeof(test_block) + KB(4), 0);
+   test_block* blocks = new(&blocks_arena, test_block, count);
+   test_check(shared.header && !arena_end(&blocks_arena, blocks), "out of memory");
+   if(test_failures)
+      return;
+
+   byte* start = shared.beg;
+   pthread_t threads[TEST_THREADS];
+   test_thread args[TEST_THREADS];
+
+   for(i32 i = 0; i < TEST_THREADS; ++i)
+   {
+      args[i].shared = &shared;
+      args[i].blocks = blocks + i*TEST_ALLOCS_PER_THREAD;
+      args[i].count = TEST_ALLOCS_PER_THREAD;
+      args[i].seed = test_random() | 1;
+      args[i].uniform = uniform;
+      pthread_create(&threads[i], 0, test_thread_alloc_atomic, &args[i]);
+   }
+   for(i32 i = 0; i < TEST_THREADS; ++i)
+      pthread_join(threads[i], 0);
+
+   size granted = 0;
+   for(size i = 0; i < count; ++i)
+   {
+      test_check(!arena_end(&shared, blocks[i].p), "block %td failed", i);
+      test_check(((uptr)blocks[i].p & (blocks[i].align - 1)) == 0, "block %td misaligned", i);
+      granted += blocks[i].bytes;
+   }
+
+   qsort(blocks, count, sizeof(test_block), test_block_compare);
+
+   // only alignment padding may sit between neighbours
+   test_check(blocks[0].p >= start && blocks[0].p - start < blocks[0].align, "first block off the start");
+   for(size i = 1; i < count; ++i)
+   {
+      byte* end = blocks[i - 1].p + blocks[i - 1].bytes;
+      test_check(end <= blocks[i].p, "blocks %td and %td overlap", i - 1, i);
+      test_check(blocks[i].p - end < blocks[i].align, "gap before block %td", i);
+   }
+
+   byte* last = blocks[count - 1].p + blocks[count - 1].bytes;
+   test_check(shared.beg == last, "beg is %td bytes past the last block", shared.beg - last);
+   if(uniform)
+      test_check(shared.beg - start == granted, "used %td bytes for %td granted", shared.beg - start, granted);
+
+   arena_free(&blocks_arena);
+   arena_free(&shared);
+}
+
+static void test_alloc_atomic_mixed()
+{
+   test_alloc_atomic_run(false);
+}
+
+static void test_alloc_atomic_uniform()
+{
+   test_alloc_atomic_run(true);
+}
+
+// A growable arena only bumps through the committed pages and fails past them
+static void test_alloc_atomic_growable()
+{
+   arena a = arena_new_growable(MB(16), MB(1), 0);
+   test_check(a.header, "out of memory");
+   if(test_failures)
+      return;
+
+   byte* commit = a.header->commit;
+   for(;;)
+   {
+      byte* p = alloc_atomic(&a, 1000, 8, 1, 0);
+      if(arena_end(&a, p))
+         break;
+      test_check(p + 1000 <= commit, "block past the committed pages");
+   }
+
+   test_check(a.header->commit == commit, "alloc_atomic committed pages");
+   test_check(a.beg <= commit && commit - a.beg < 1000 + 8, "stopped %td bytes before the commit end", commit - a.beg);
+
+   arena_free(&a);
+}
+
+// Chunks are committed as the arena crosses them and handed back by arena_reset down to keep
+static void test_arena_growable_commit()
+{
+   const size chunk = KB(64);
+   arena a = arena_new_growable(MB(4), chunk, 0);
+   test_check(a.header, "out of memory");
+   if(test_failures)
+      return;
+
+   byte* base = (byte*)a.header;
+   test_check(a.header->commit == base + chunk, "first commit is %td bytes", a.header->commit - base);
+
+   // sizes that end inside, exactly on and across chunk boundaries
+   const size sizes[] = {1000, KB(63), KB(64), 1, KB(200), 3*KB(64) - 7};
+   for(size i = 0; i < countof(sizes); ++i)
+   {
+      byte* p = new(&a, byte, sizes[i]);
+      test_check(!arena_end(&a, p), "alloc %td failed", i);
+      if(arena_end(&a, p))
+         return;
+
+      // every byte handed out is writable
+      memset(p, 0xab, sizes[i]);
+
+      size committed = a.header->commit - base;
+      test_check(committed % chunk == 0, "commit of %td bytes is not whole chunks", committed);
+      test_check(a.header->commit >= a.beg && a.header->commit - a.beg < chunk, "commit %td bytes past beg", a.header->commit - a.beg);
+   }
+
+   // the last chunk is committed and nothing past the reservation
+   byte* rest = new(&a, byte, a.end - a.beg);
+   test_check(!arena_end(&a, rest) && a.header->commit == a.header->end, "could not fill the reservation");
+   test_check(arena_end(&a, new(&a, byte)), "alloc past the reservation");
+
+   const size keeps[] = {KB(100), KB(64) - (size)sizeof(arena_header), 1, 0};
+   for(size i = 0; i < countof(keeps); ++i)
+   {
+      arena_reset(&a, keeps[i]);
+
+      byte* keep = arena_first(a.header) + keeps[i];
+      size expected = ((keep - base) + chunk - 1) / chunk*chunk;
+      expected = expected < chunk ? chunk : expected;
+
+      test_check(a.beg == arena_first(a.header), "reset left beg at %td", a.beg - base);
+      test_check(a.header->commit == base + expected, "keep %td left %td bytes committed, not %td",
+                 keeps[i], a.header->commit - base, expected);
+      test_check(a.header->peak <= a.header->commit, "peak past the commit");
+   }
+
+   // decommitted pages come back zeroed when committed again
+   byte* p = new(&a, byte, KB(256));
+   test_check(!arena_end(&a, p), "alloc after the reset failed");
+   if(!arena_end(&a, p))
+   {
+      size dirty = 0;
+      for(size i = chunk - (size)sizeof(arena_header); i < KB(256); ++i)
+         dirty += p[i] != 0;
+      test_check(dirty == 0, "%td bytes kept their contents after the decommit", dirty);
+   }
+
+   arena_free(&a);
+}
+
+// Copies of a scratch push the shared peak, the reset zeroes only up to it
+static void test_scratch_reset()
+{
+   arena a = arena_new(KB(64), 0);
+   test_check(a.header, "out of memory");
+   if(test_failures)
+      return;
+
+   // bytes past the peak were never handed out, the reset leaves them alone
+   memset(a.beg, 0x11, KB(8));
+
+   arena copy = a;
+   byte* p = new(&copy, byte, 1000);
+   memset(p, 0xab, 1000);
+   arena nested = copy;
+   byte* q = new(&nested, byte, 3000);
+   memset(q, 0xab, 3000);
+
+   test_check(a.header->peak == nested.beg, "peak %td bytes off the last copy", a.header->peak - nested.beg);
+
+   scratch_reset(&a, true);
+
+   size dirty = 0, kept = 0;
+   for(size i = 0; i < q + 3000 - a.beg; ++i)
+      dirty += a.beg[i] != 0;
+   for(byte* i = q + 3000; i < a.beg + KB(8); ++i)
+      kept += *i == 0x11;
+   test_check(dirty == 0, "%td bytes below the peak not cleared", dirty);
+   test_check(kept == a.beg + KB(8) - (q + 3000), "the reset cleared past the peak");
+   test_check(a.header->peak == a.beg, "the peak did not rewind");
+
+   // without zeroing only the peak moves
+   p = new(&copy, byte, 100);
+   memset(p, 0xab, 100);
+   scratch_reset(&a, false);
+   test_check(p[99] == 0xab && a.header->peak == a.beg, "reset without zero");
+
+   arena_free(&a);
+}
+
+// Nested marks on a growable arena, the allocations between them cross chunk boundaries
+static void test_arena_rewind()
+{
+   arena a = arena_new_growable(MB(4), KB(64), 0);
+   test_check(a.header, "out of memory");
+   if(test_failures)
+      return;
+
+   new(&a, byte, 100);
+   arena_checkpoint outer = arena_mark(&a);
+   byte* first = new(&a, byte, KB(100));
+
+   arena_checkpoint inner = arena_mark(&a);
+   u32* second = new(&a, u32, KB(50));
+   byte* commit = a.header->commit;
+
+   arena_rewind(&a, inner);
+   test_check(a.beg == inner.beg, "inner rewind left beg %td bytes off", a.beg - inner.beg);
+   test_check(a.header->commit == commit, "rewind changed the commit");
+   test_check(new(&a, u32, KB(50)) == second, "the same allocation moved after the rewind");
+
+   arena_rewind(&a, outer);
+   test_check(a.beg == outer.beg, "outer rewind left beg %td bytes off", a.beg - outer.beg);
+   test_check(new(&a, byte, KB(100)) == first, "the same allocation moved after the outer rewind");
+
+   // shrinking keeps the prefix of the last allocation
+   u32* worst = new(&a, u32, 1000);
+   for(u32 i = 0; i < 1000; ++i)
+      worst[i] = i;
+   arena_shrink_to(&a, worst, 10*sizeof(u32));
+   test_check(a.beg == (byte*)(worst + 10) && worst[9] == 9, "shrink left beg %td bytes off", a.beg - (byte*)(worst + 10));
+
+   arena_free(&a);
+}
+
+// A freed slot comes back with a new generation, so handles to its old object stop resolving
+static void test_pool_generations()
+{
+   arena a = arena_new(KB(64), 0);
+   pool p = pool_new(&a, u64, 4);
+   test_check(p.slots, "out of memory");
+   if(test_failures)
+      return;
+
+   pool_handle stale = pool_alloc(&p);
+   *pool_get(&p, u64, stale) = 42;
+   pool_free(&p, stale);
+   test_check(!pool_valid(&p, stale) && !pool_get(&p, u64, stale), "freed handle still resolves");
+
+   pool_handle reused = pool_alloc(&p);
+   test_check(reused.index == stale.index && reused.generation != stale.generation, "slot not reused with a new generation");
+   test_check(!pool_get(&p, u64, stale), "stale handle resolves to the reused slot");
+   test_check(pool_get(&p, u64, reused) && *pool_get(&p, u64, reused) == 0, "reused slot not zeroed");
+
+   pool_handle handles[4] = {reused};
+   for(i32 i = 1; i < 4; ++i)
+      handles[i] = pool_alloc(&p);
+   test_check(pool_is_full(&p) && pool_handle_null(pool_alloc(&p)), "full pool handed out a slot");
+
+   // clear invalidates every live handle, the slots come back with fresh generations
+   pool_clear(&p);
+   for(i32 i = 0; i < 4; ++i)
+      test_check(!pool_get(&p, u64, handles[i]), "handle %d survived the clear", i);
+
+   pool_handle fresh = pool_alloc(&p);
+   test_check(fresh.index == handles[0].index && fresh.generation > handles[0].generation, "clear reused a generation");
+   test_check(!pool_get(&p, u64, stale) && !pool_get(&p, u64, reused), "old handles resolve after the clear");
+
+   arena_free(&a);
+}
+
+#if defined(ARENA_TELEMETRY)
+static char test_dump[4096];
+static i32 test_dump_length;
+
+static void test_dump_print(const char* format, ...)
+{
+   va_list args;
+   va_start(args, format);
+   test_dump_length += vsnprintf(test_dump + test_dump_length, sizeof(test_dump) - test_dump_length, format, args);
+   va_end(args);
+}
+
+// Counters after a known run of allocations, rewinds and one failure on a growable arena
+static void test_arena_telemetry()
+{
+   const size chunk = KB(64);
+   arena a = arena_new_growable(MB(1), chunk, 0);
+   test_check(a.header, "out of memory");
+   if(test_failures)
+      return;
+
+   const arena_stats* stats = arena_stats_get(&a);
+   byte* base = (byte*)a.header;
+   byte* first = arena_first(a.header);
+
+   new(&a, byte, 3);
+   u32 loop_line = __LINE__ + 2;
+   for(i32 i = 0; i < 3; ++i)
+      new(&a, u64, 2);   // 5 bytes padding before the first
+
+   arena_checkpoint mark = arena_mark(&a);
+   new(&a, byte, KB(100));
+   size peak = a.beg - first;
+   byte* commit = a.header->commit;
+
+   arena_rewind(&a, mark);
+   new(&a, byte, KB(10));
+
+   u32 failed_line = __LINE__ + 1;
+   test_check(arena_end(&a, new(&a, byte, MB(2))), "alloc past the reservation");
+
+   test_check(stats->peak == peak, "peak %td, not %td", stats->peak, peak);
+   test_check(stats->bytes == 3 + 3*16 + KB(100) + KB(10), "%td bytes", stats->bytes);
+   test_check(stats->padding == 5, "%td padding", stats->padding);
+   test_check(stats->tag_count == 4, "%u tags", stats->tag_count);
+   test_check(stats->failure_count == 1 && stats->failed_line == failed_line && stats->failed_bytes == MB(2), "failure not recorded");
+
+   // the big allocation committed the chunks up to the peak and the rewind kept them
+   size chunks = (first + peak - base + chunk - 1) / chunk;
+   test_check(commit - base == chunks*chunk, "commit of %td bytes, not %td chunks", commit - base, chunks);
+   test_check(a.header->commit == commit, "the rewind changed the commit");
+
+   bool found = false;
+   for(u32 i = 0; i < stats->tag_count; ++i)
+      if(stats->tags[i].line == loop_line)
+      {
+         found = true;
+         test_check(stats->tags[i].count == 3 && stats->tags[i].bytes == 48 && stats->tags[i].padding == 5, "loop tag counts");
+      }
+   test_check(found, "no tag for line %u", loop_line);
+
+   test_dump_length = 0;
+   arena_stats_dump(&a, "test", test_dump_print);
+   test_check(strstr(test_dump, "1 failures") && strstr(test_dump, "3 allocs"), "dump:\n%s", test_dump);
+
+   arena_free(&a);
+}
+#endif
+
+enum { TEST_MATH_COUNT = 200000 };
+
+// Inputs the backends are most likely to disagree on
+static const f32 test_edge_values[] =
+{
+   0.0f, -0.0f, 1.0f, -1.0f, 1e-45f, -1e-45f, 1e-40f, 1.17549435e-38f, 1e30f, -1e30f,
+   3.40282347e+38f, -3.40282347e+38f, INFINITY, -INFINITY,
+};
+
+// Every bit pattern now and then, so denormals, infinities and nans too
+static f32 test_random_f32()
+{
+   u32 x = test_random();
+   u32 kind = x & 3;
+   x = test_random();
+
+   if(kind == 0)
+   {
+      f32 result;
+      memcpy(&result, &x, sizeof(result));
+      return result;
+   }
+   if(kind == 1)
+      return test_edge_values[x % countof(test_edge_values)];
+
+   return (f32)x / (f32)0xffffffffu*2.0f - 1.0f;
+}
+
+static vec4 test_random_vec4()
+{
+   return vec4_set(test_random_f32(), test_random_f32(), test_random_f32(), test_random_f32());
+}
+
+static mat4 test_random_mat4()
+{
+   mat4 result;
+   for(i32 i = 0; i < 16; ++i)
+      result.data[i] = test_random_f32();
+
+   return result;
+}
+
+// Same bits, or both nan since the payload depends on the operand order
+static bool test_same_f32(f32 a, f32 b)
+{
+   return memcmp(&a, &b, sizeof(f32)) == 0 || (a != a && b != b);
+}
+
+static bool test_same_vec4(vec4 a, vec4 b)
+{
+   for(i32 i = 0; i < 4; ++i)
+      if(!test_same_f32(a.data[i], b.data[i]))
+         return false;
+
+   return true;
+}
+
+// Scalar references in the order graphics.h documents for every backend
+static vec4 test_reference_transform(vec4 v, mat4 m)
+{
+   vec4 result;
+   for(i32 j = 0; j < 4; ++j)
+      result.data[j] = v.data[0]*m.data[0 + j] + v.data[1]*m.data[4 + j] + v.data[2]*m.data[8 + j] + v.data[3]*m.data[12 + j];
+
+   return result;
+}
+
+static void test_vec4_backend()
+{
+   for(i32 n = 0; n < TEST_MATH_COUNT; ++n)
+   {
+      vec4 a = test_random_vec4();
+      vec4 b = test_random_vec4();
+      f32 s = test_random_f32();
+      vec4 expected;
+
+      for(i32 i = 0; i < 4; ++i)
+         expected.data[i] = a.data[i] + b.data[i];
+      test_check(test_same_vec4(vec4_add(a, b), expected), "vec4_add %d", n);
+
+      for(i32 i = 0; i < 4; ++i)
+         expected.data[i] = a.data[i] - b.data[i];
+      test_check(test_same_vec4(vec4_sub(a, b), expected), "vec4_sub %d", n);
+
+      for(i32 i = 0; i < 4; ++i)
+         expected.data[i] = a.data[i]*b.data[i];
+      test_check(test_same_vec4(vec4_mul(a, b), expected), "vec4_mul %d", n);
+
+      for(i32 i = 0; i < 4; ++i)
+         expected.data[i] = a.data[i]*s;
+      test_check(test_same_vec4(vec4_scale(a, s), expected), "vec4_scale %d", n);
+
+      f32 dot = (a.x*b.x + a.y*b.y) + (a.z*b.z + a.w*b.w);
+      test_check(test_same_f32(vec4_dot(a, b), dot), "vec4_dot %d: %g against %g", n, vec4_dot(a, b), dot);
+
+      expected = vec4_set(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x, 0.0f);
+      test_check(test_same_vec4(vec4_cross(a, b), expected), "vec4_cross %d", n);
+   }
+}
+
+static void test_mat4_backend()
+{
+   for(i32 n = 0; n < TEST_MATH_COUNT; ++n)
+   {
+      mat4 a = test_random_mat4();
+      mat4 b = test_random_mat4();
+      vec4 v = test_random_vec4();
+
+      test_check(test_same_vec4(vec4_transform(v, a), test_reference_transform(v, a)), "vec4_transform %d", n);
+
+      mat4 r = mat4_mul(a, b);
+      for(i32 i = 0; i < 4; ++i)
+         test_check(test_same_vec4(r.rows[i], test_reference_transform(a.rows[i], b)), "mat4_mul %d row %d", n, i);
+
+      mat4 t = mat4_transpose(a);
+      for(i32 i = 0; i < 16; ++i)
+         test_check(test_same_f32(t.data[i], a.data[(i & 3)*4 + (i >> 2)]), "mat4_transpose %d", n);
+   }
+}
+
+// Fixed point inputs from every magnitude, with the extremes now and then
+static fp test_random_fixed()
+{
+   static const fp edges[] = {0, 1, -1, 0x7fffffff, (fp)0x80000000, 0x10000, -0x10000, 0x8000, -0x8000};
+
+   u32 x = test_random();
+   if((x & 7) == 0)
+      return edges[(x >> 3) % countof(edges)];
+
+   return (fp)test_random() >> (x % 31);
+}
+
+// The four lane versions against the scalar ones lane by lane
+static void test_fixed4_backend()
+{
+   static const i32 fracs[] = {0, 1, FP_Q24_8, FP_Q16_16, 24, 31};
+
+   for(i32 n = 0; n < TEST_MATH_COUNT; ++n)
+   {
+      fp a[4], b[4], result[4];
+      f32 f[4], g[4];
+      for(i32 i = 0; i < 4; ++i)
+      {
+         a[i] = test_random_fixed();
+         b[i] = test_random_fixed();
+      }
+      i32 frac = fracs[n % countof(fracs)];
+
+      FP_fixed4_store(FP_fixed4_mul(FP_fixed4_load(a), FP_fixed4_load(b), frac), result);
+      for(i32 i = 0; i < 4; ++i)
+         test_check(result[i] == FP_fixed_mul(a[i], b[i], frac), "FP_fixed4_mul %d: %d*%d >> %d is %d, not %d",
+                    n, a[i], b[i], frac, result[i], FP_fixed_mul(a[i], b[i], frac));
+
+      FP_fixed4_store(FP_fixed4_add(FP_fixed4_load(a), FP_fixed4_load(b)), result);
+      for(i32 i = 0; i < 4; ++i)
+         test_check(result[i] == (fp)((u32)a[i] + (u32)b[i]), "FP_fixed4_add %d", n);
+
+      FP_fixed4_store(FP_fixed4_sub(FP_fixed4_load(a), FP_fixed4_load(b)), result);
+      for(i32 i = 0; i < 4; ++i)
+         test_check(result[i] == (fp)((u32)a[i] - (u32)b[i]), "FP_fixed4_sub %d", n);
+
+      // conversions only inside the range the format holds
+      frac = n & 1 ? FP_Q16_16 : FP_Q24_8;
+      for(i32 i = 0; i < 4; ++i)
+         f[i] = test_uniform(-30000.0f, 30000.0f);
+      FP_fixed4_store(FP_to_fixed_point4(f, frac), result);
+      FP_fixed4_to_f32(FP_fixed4_load(a), frac, g);
+      for(i32 i = 0; i < 4; ++i)
+      {
+         test_check(result[i] == FP_to_fixed_point(f[i], frac), "FP_to_fixed_point4 %d: %g", n, f[i]);
+         test_check(test_same_f32(g[i], FP_fixed_to_f32(a[i], frac)), "FP_fixed4_to_f32 %d: %d", n, a[i]);
+      }
+   }
+}
+
+enum { TEST_SOA_COUNT = 1003, TEST_SOA_ROUNDS = 500 };   // not a multiple of 8 so the remainders run too
+
+typedef void (*test_transform_soa_function)(mat4 m, const f32* x, const f32* y, const f32* z, size n,
+                                            f32* ox, f32* oy, f32* oz, f32* ow, bool divide);
+
+// Every batched transform matches vec4_transform of (x, y, z, 1) bit for bit, divided by w on request
+static void test_transform_soa()
+{
+   static f32 x[TEST_SOA_COUNT], y[TEST_SOA_COUNT], z[TEST_SOA_COUNT];
+   static f32 ox[TEST_SOA_COUNT], oy[TEST_SOA_COUNT], oz[TEST_SOA_COUNT], ow[TEST_SOA_COUNT];
+
+   const test_transform_soa_function functions[] =
+   {
+      g_transform_soa, g_transform_soa_scalar,
+#if defined(G_SIMD_SSE)
+      g_transform_soa_sse,
+#endif
+#if defined(G_SIMD_AVX)
+      g_transform_soa_avx,
+#endif
+   };
+
+   for(i32 round = 0; round < TEST_SOA_ROUNDS; ++round)
+   {
+      mat4 m = test_random_mat4();
+      for(i32 i = 0; i < TEST_SOA_COUNT; ++i)
+      {
+         x[i] = test_random_f32();
+         y[i] = test_random_f32();
+         z[i] = test_random_f32();
+      }
+
+      const bool divide = round & 1;
+      for(i32 k = 0; k < countof(functions); ++k)
+      {
+         // without ow every other round
+         f32* w = round & 2 ? ow : 0;
+         functions[k](m, x, y, z, TEST_SOA_COUNT, ox, oy, oz, w, divide);
+
+         for(i32 i = 0; i < TEST_SOA_COUNT; ++i)
+         {
+            vec4 e = vec4_transform(vec4_set(x[i], y[i], z[i], 1.0f), m);
+            if(divide)
+               e = vec4_set(e.x / e.w, e.y / e.w, e.z / e.w, e.w);
+
+            bool same = test_same_f32(ox[i], e.x) && test_same_f32(oy[i], e.y) && test_same_f32(oz[i], e.z);
+            test_check(same && (!w || test_same_f32(w[i], e.w)), "kernel %d round %d point %d: (%g %g %g %g), not (%g %g %g %g)",
+                       k, round, i, ox[i], oy[i], oz[i], w ? w[i] : 0.0f, e.x, e.y, e.z, e.w);
+         }
+      }
+   }
+}
+
+enum { TEST_INVERSE_COUNT = 100000 };
+
+// Inverse errors grow with the condition number, so the bound is this many epsilons times kappa
+#define TEST_INVERSE_TOLERANCE 64.0
+
+static f64 test_norm_inf(mat4 m)
+{
+   f64 result = 0.0;
+   for(i32 i = 0; i < 4; ++i)
+   {
+      f64 sum = 0.0;
+      for(i32 j = 0; j < 4; ++j)
+         sum += fabs((f64)m.data[i*4 + j]);
+      result = sum > result ? sum : result;
+   }
+
+   return result;
+}
+
+// Determinant in doubles by the same 2x2 minors of rows 0, 1 and rows 2, 3 as the inverse
+static f64 test_determinant(mat4 m)
+{
+   const i32 pairs[6][2] = {{0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {2, 3}};
+   f64 s[6], c[6];
+
+   for(i32 i = 0; i < 6; ++i)
+   {
+      const i32 x = pairs[i][0], y = pairs[i][1];
+      s[i] = (f64)m.data[0 + x]*m.data[4 + y] - (f64)m.data[4 + x]*m.data[0 + y];
+      c[i] = (f64)m.data[8 + x]*m.data[12 + y] - (f64)m.data[12 + x]*m.data[8 + y];
+   }
+
+   return s[0]*c[5] - s[1]*c[4] + s[2]*c[3] + s[3]*c[2] - s[4]*c[1] + s[5]*c[0];
+}
+
+// Largest entry of m*inverse - identity in doubles over epsilon*kappa, must stay under the tolerance
+static f64 test_inverse_error(mat4 m, mat4 inverse)
+{
+   f64 error = 0.0;
+   for(i32 i = 0; i < 4; ++i)
+      for(i32 j = 0; j < 4; ++j)
+      {
+         f64 sum = i == j ? -1.0 : 0.0;
+         for(i32 k = 0; k < 4; ++k)
+            sum += (f64)m.data[i*4 + k]*(f64)inverse.data[k*4 + j];
+         error = fabs(sum) > error ? fabs(sum) : error;
+      }
+
+   f64 kappa = test_norm_inf(m)*test_norm_inf(inverse);
+
+   return error / ((f64)FLT_EPSILON*kappa);
+}
+
+// Rotation with per axis scale and a translation
+static mat4 test_random_affine()
+{
+   vec3 axis = {{test_uniform(-1.0f, 1.0f), test_uniform(-1.0f, 1.0f), test_uniform(-1.0f, 1.0f) + 2.0f}};
+   f32 length = sqrtf(axis.x*axis.x + axis.y*axis.y + axis.z*axis.z);
+   axis.x /= length; axis.y /= length; axis.z /= length;
+
+   mat4 result = quat_to_mat4(quat_from_axis_angle(axis, test_uniform(-3.14f, 3.14f)));
+   for(i32 i = 0; i < 3; ++i)
+      result.rows[i] = vec4_scale(result.rows[i], test_uniform(0.05f, 20.0f));
+   result.rows[3] = vec4_set(test_uniform(-100.0f, 100.0f), test_uniform(-100.0f, 100.0f), test_uniform(-100.0f, 100.0f), 1.0f);
+
+   return result;
+}
+
+static f64 test_worst;
+
+static void test_inverse_check(mat4 m, const char* kind, i32 n)
+{
+   f64 error = test_inverse_error(m, mat4_inverse(m));
+   test_worst = error > test_worst ? error : test_worst;
+   test_check(error <= TEST_INVERSE_TOLERANCE, "%s %d: m*inverse off by %.1f epsilon*kappa", kind, n, error);
+}
+
+static void test_mat4_inverse_affine()
+{
+   test_worst = 0.0;
+   for(i32 n = 0; n < TEST_INVERSE_COUNT; ++n)
+   {
+      mat4 m = test_random_affine();
+      mat4 affine = mat4_inverse_affine(m);
+      mat4 general = mat4_inverse(m);
+
+      f64 error = test_inverse_error(m, affine);
+      test_worst = error > test_worst ? error : test_worst;
+      test_check(error <= TEST_INVERSE_TOLERANCE, "affine %d: m*inverse off by %.1f epsilon*kappa", n, error);
+      test_inverse_check(m, "general on affine", n);
+
+      // both inverses agree to the same bound, relative to the largest entry
+      f64 largest = 0.0, difference = 0.0;
+      for(i32 i = 0; i < 16; ++i)
+      {
+         largest = fabs(general.data[i]) > largest ? fabs(general.data[i]) : largest;
+         difference = fabs(general.data[i] - affine.data[i]) > difference ? fabs(general.data[i] - affine.data[i]) : difference;
+      }
+      f64 kappa = test_norm_inf(m)*test_norm_inf(general);
+      test_check(difference <= TEST_INVERSE_TOLERANCE*FLT_EPSILON*kappa*largest, "affine %d: inverses differ by %g", n, difference);
+   }
+   printf("   worst %.2f epsilon*kappa\n", test_worst);
+}
+
+// Projections after a view transform, the near plane from 0.01 to 1 and far up to 10000
+static void test_mat4_inverse_perspective()
+{
+   test_worst = 0.0;
+   for(i32 n = 0; n < TEST_INVERSE_COUNT; ++n)
+   {
+      f32 near = test_uniform(0.01f, 1.0f);
+      mat4 projection = mat4_perspective_fov(test_uniform(30.0f, 120.0f), test_uniform(0.5f, 2.5f), near, near*test_uniform(10.0f, 10000.0f));
+
+      test_inverse_check(projection, "perspective", n);
+      test_inverse_check(mat4_mul(test_random_affine(), projection), "view perspective", n);
+   }
+   printf("   worst %.2f epsilon*kappa\n", test_worst);
+}
+
+// The last row within 0.1 to 0.0001 of a combination of the others, so kappa grows as it closes in
+static void test_mat4_inverse_near_singular()
+{
+   test_worst = 0.0;
+   for(i32 n = 0; n < TEST_INVERSE_COUNT; ++n)
+   {
+      mat4 m;
+      for(i32 i = 0; i < 12; ++i)
+         m.data[i] = test_uniform(-1.0f, 1.0f);
+
+      f32 a = test_uniform(-1.0f, 1.0f), b = test_uniform(-1.0f, 1.0f), c = test_uniform(-1.0f, 1.0f);
+      f32 delta = powf(10.0f, -(f32)(1 + n % 4));
+      for(i32 j = 0; j < 4; ++j)
+         m.data[12 + j] = a*m.data[j] + b*m.data[4 + j] + c*m.data[8 + j] + delta*test_uniform(-1.0f, 1.0f);
+
+      // the inverse requires a non singular m, skip the rare draws the float determinant could round to zero
+      if(fabs(test_determinant(m)) < 1e-5)
+         continue;
+
+      mat4 inverse = mat4_inverse(m);
+      f64 error = test_inverse_error(m, inverse);
+      test_worst = error > test_worst ? error : test_worst;
+      test_check(error <= TEST_INVERSE_TOLERANCE, "near singular %d: m*inverse off by %.1f epsilon*kappa", n, error);
+   }
+   printf("   worst %.2f epsilon*kappa\n", test_worst);
+}
+
+enum { TEST_CULL_COUNT = 1003, TEST_CULL_ROUNDS = 200 };   // not a multiple of 8 so the remainders run too
+
+static bool test_same_visible(const u32* a, size a_count, const u32* b, size b_count)
+{
+   return a_count == b_count && memcmp(a, b, a_count*sizeof(u32)) == 0;
+}
+
+// Every culling kernel the target has keeps exactly the volumes the scalar one keeps
+static void test_frustum_cull_backend()
+{
+   static f32 x[TEST_CULL_COUNT], y[TEST_CULL_COUNT], z[TEST_CULL_COUNT];
+   static f32 ex[TEST_CULL_COUNT], ey[TEST_CULL_COUNT], ez[TEST_CULL_COUNT];
+   static u32 expected[TEST_CULL_COUNT], visible[TEST_CULL_COUNT];
+   size kept = 0;
+
+   for(i32 round = 0; round < TEST_CULL_ROUNDS; ++round)
+   {
+      g_frustum frustum;
+      mat4 projection = mat4_perspective_fov(test_uniform(30.0f, 120.0f), test_uniform(0.5f, 2.5f), 0.5f, test_uniform(20.0f, 200.0f));
+      g_frustum_from_matrix(&frustum, mat4_mul(test_random_affine(), projection));
+
+      for(i32 i = 0; i < TEST_CULL_COUNT; ++i)
+      {
+         x[i] = test_uniform(-150.0f, 150.0f);
+         y[i] = test_uniform(-150.0f, 150.0f);
+         z[i] = test_uniform(-150.0f, 150.0f);
+         ex[i] = test_uniform(0.0f, 20.0f);
+         ey[i] = test_uniform(0.0f, 20.0f);
+         ez[i] = test_uniform(0.0f, 20.0f);
+      }
+
+      size count = g_frustum_cull_spheres_scalar(&frustum, x, y, z, ex, TEST_CULL_COUNT, expected);
+      size found = g_frustum_cull_spheres(&frustum, x, y, z, ex, TEST_CULL_COUNT, visible);
+      test_check(test_same_visible(expected, count, visible, found), "spheres %d: %td visible, not %td", round, found, count);
+#if defined(G_SIMD_SSE)
+      found = g_frustum_cull_spheres_sse(&frustum, x, y, z, ex, TEST_CULL_COUNT, visible);
+      test_check(test_same_visible(expected, count, visible, found), "spheres sse %d: %td visible, not %td", round, found, count);
+#endif
+#if defined(G_SIMD_AVX)
+      found = g_frustum_cull_spheres_avx(&frustum, x, y, z, ex, TEST_CULL_COUNT, visible);
+      test_check(test_same_visible(expected, count, visible, found), "spheres avx %d: %td visible, not %td", round, found, count);
+#endif
+
+      count = g_frustum_cull_aabbs_scalar(&frustum, x, y, z, ex, ey, ez, TEST_CULL_COUNT, expected);
+      found = g_frustum_cull_aabbs(&frustum, x, y, z, ex, ey, ez, TEST_CULL_COUNT, visible);
+      test_check(test_same_visible(expected, count, visible, found), "aabbs %d: %td visible, not %td", round, found, count);
+#if defined(G_SIMD_SSE)
+      found = g_frustum_cull_aabbs_sse(&frustum, x, y, z, ex, ey, ez, TEST_CULL_COUNT, visible);
+      test_check(test_same_visible(expected, count, visible, found), "aabbs sse %d: %td visible, not %td", round, found, count);
+#endif
+#if defined(G_SIMD_AVX)
+      found = g_frustum_cull_aabbs_avx(&frustum, x, y, z, ex, ey, ez, TEST_CULL_COUNT, visible);
+      test_check(test_same_visible(expected, count, visible, found), "aabbs avx %d: %td visible, not %td", round, found, count);
+#endif
+      kept += count;
+   }
+
+   // some of every kind
+   test_check(kept > 0 && kept < TEST_CULL_ROUNDS*TEST_CULL_COUNT, "kept %td boxes", kept);
+}
+
+// Right handed projection down -z with 0 <= z <= w, the convention g_frustum_from_matrix expects
+static mat4 test_projection(f32 hfov, f32 aspect, f32 n, f32 f)
+{
+   mat4 result = {0};
+   result.data[0] = 1.0f / tanf(DEG_TO_RAD(hfov)*0.5f);
+   result.data[5] = result.data[0]*aspect;
+   result.data[10] = f / (n - f);
+   result.data[11] = -1.0f;
+   result.data[14] = n*f / (n - f);
+
+   return result;
+}
+
+// Planes of a known projection match the view space frustum, and the planes of a view projection
+// put points on the same side as the clip space test
+static void test_frustum_from_matrix()
+{
+   for(i32 round = 0; round < 1000; ++round)
+   {
+      f32 hfov = test_uniform(30.0f, 120.0f), width = test_uniform(100.0f, 4000.0f), height = test_uniform(100.0f, 4000.0f);
+      f32 n = test_uniform(0.01f, 1.0f), f = n*test_uniform(10.0f, 10000.0f);
+      mat4 projection = test_projection(hfov, width / height, n, f);
+
+      g_frustum expected, frustum;
+      g_frustum_create(&expected, width, height, hfov, n, f);
+      g_frustum_from_matrix(&frustum, projection);
+
+      const g_plane* a = g_frustum_planes(&expected);
+      const g_plane* b = g_frustum_planes(&frustum);
+      for(i32 i = 0; i < G_FRUSTUM_PLANE_COUNT; ++i)
+      {
+         f32 error = fabsf(a[i].n.x - b[i].n.x) + fabsf(a[i].n.y - b[i].n.y) + fabsf(a[i].n.z - b[i].n.z);
+         test_check(error < 1e-5f, "round %d plane %d: normal (%g %g %g), not (%g %g %g)", round, i,
+                    b[i].n.x, b[i].n.y, b[i].n.z, a[i].n.x, a[i].n.y, a[i].n.z);
+
+         // the far plane comes from w - z, which cancels down to about n/f of the terms
+         f32 tolerance = i == 5 ? 8.0f*FLT_EPSILON*(f / n) : 1e-5f;
+         test_check(fabsf(a[i].d - b[i].d) <= tolerance*fabsf(a[i].d) + 1e-6f, "round %d plane %d: d %g, not %g", round, i, b[i].d, a[i].d);
+      }
+
+      // world space planes through a camera transform
+      mat4 m = mat4_mul(test_random_affine(), projection);
+      g_frustum_from_matrix(&frustum, m);
+      for(i32 k = 0; k < 100; ++k)
+      {
+         vec4 p = vec4_set(test_uniform(-200.0f, 200.0f), test_uniform(-200.0f, 200.0f), test_uniform(-200.0f, 200.0f), 1.0f);
+         vec4 c = vec4_transform(p, m);
+         f64 clip[G_FRUSTUM_PLANE_COUNT] = {c.w + c.x, c.w - c.x, c.w - c.y, c.w + c.y, c.z, c.w - c.z};
+
+         for(i32 i = 0; i < G_FRUSTUM_PLANE_COUNT; ++i)
+         {
+            f32 distance = b[i].n.x*p.x + b[i].n.y*p.y + b[i].n.z*p.z + b[i].d;
+
+            // skip points too close to the plane for the sign to hold in floats
+            if(fabs(clip[i]) < 1e-3*fabs(c.w) + 1e-3)
+               continue;
+            test_check((distance <= 0.0f) == (clip[i] >= 0.0), "round %d plane %d: distance %g against clip %g", round, i, distance, clip[i]);
+         }
+      }
+   }
+}
+
+// Twelve triangles of the unit cube around the origin, wound so every plane normal points out
+static void test_cube_faces(f32 faces[12*9])
+{
+   // corners of each side, counter clockwise seen from outside
+   static const f32 sides[6][4][3] =
+   {
+      {{ 1, -1, -1}, { 1,  1, -1}, { 1,  1,  1}, { 1, -1,  1}},
+      {{-1, -1, -1}, {-1, -1,  1}, {-1,  1,  1}, {-1,  1, -1}},
+      {{-1,  1, -1}, {-1,  1,  1}, { 1,  1,  1}, { 1,  1, -1}},
+      {{-1, -1, -1}, { 1, -1, -1}, { 1, -1,  1}, {-1, -1,  1}},
+      {{-1, -1,  1}, { 1, -1,  1}, { 1,  1,  1}, {-1,  1,  1}},
+      {{-1, -1, -1}, {-1,  1, -1}, { 1,  1, -1}, { 1, -1, -1}},
+   };
+
+   for(i32 i = 0; i < 6; ++i)
+   {
+      static const i32 fan[6] = {0, 1, 2, 0, 2, 3};
+      for(i32 k = 0; k < 6; ++k)
+         memcpy(faces + i*18 + k*3, sides[i][fan[k]], 3*sizeof(f32));
+
+      // flip any side the table got wrong so the test does not depend on it
+      g_plane plane;
+      bsp_face_plane(&plane, faces + i*18);
+      f32 center[3] = {0.0f, 0.0f, 0.0f};
+      if(g_plane_classify_vertex_side(&plane, center) != G_PLANE_BACK)
+         for(i32 t = 0; t < 2; ++t)
+            for(i32 c = 0; c < 3; ++c)
+            {
+               f32 swap = faces[i*18 + t*9 + 3 + c];
+               faces[i*18 + t*9 + 3 + c] = faces[i*18 + t*9 + 6 + c];
+               faces[i*18 + t*9 + 6 + c] = swap;
+            }
+   }
+}
+
+static f64 test_face_area(const f32* face)
+{
+   f64 ab[3], ac[3];
+   for(i32 i = 0; i < 3; ++i)
+   {
+      ab[i] = (f64)face[3 + i] - face[i];
+      ac[i] = (f64)face[6 + i] - face[i];
+   }
+   f64 x = ab[1]*ac[2] - ab[2]*ac[1], y = ab[2]*ac[0] - ab[0]*ac[2], z = ab[0]*ac[1] - ab[1]*ac[0];
+
+   return 0.5*sqrt(x*x + y*y + z*z);
+}
+
+// Every face of a subtree lies on its side of all the planes above it and front children follow
+// their parent. Returns the number of nodes checked
+static u32 test_bsp_node(const bsp* tree, u32 index, const g_plane* planes, const i32* sides, i32 depth)
+{
+   enum { depth_max = 64 };
+   const bsp_node* node = tree->nodes + index;
+
+   for(u32 f = 0; f < node->face_count; ++f)
+      for(i32 d = 0; d < depth; ++d)
+         for(i32 k = 0; k < 3; ++k)
+         {
+            const f32* v = tree->faces + (node->first_face + f)*9 + k*3;
+            f32 distance = planes[d].n.x*v[0] + planes[d].n.y*v[1] + planes[d].n.z*v[2] + planes[d].d;
+            test_check(sides[d] == G_PLANE_FRONT ? distance >= -1e-3f : distance <= 1e-3f,
+                       "node %u face %u on the wrong side of plane %d by %g", index, f, d, distance);
+         }
+
+   if(depth >= depth_max)
+      return 1;
+
+   g_plane below[depth_max + 1];
+   i32 below_sides[depth_max + 1];
+   memcpy(below, planes, depth*sizeof(g_plane));
+   memcpy(below_sides, sides, depth*sizeof(i32));
+   below[depth] = node->plane;
+
+   u32 count = 1;
+   if(node->front != bsp_null_index)
+   {
+      test_check(node->front == index + 1, "front child of %u is %u", index, node->front);
+      below_sides[depth] = G_PLANE_FRONT;
+      count += test_bsp_node(tree, node->front, below, below_sides, depth + 1);
+   }
+   if(node->back != bsp_null_index)
+   {
+      below_sides[depth] = G_PLANE_BACK;
+      count += test_bsp_node(tree, node->back, below, below_sides, depth + 1);
+   }
+
+   return count;
+}
+
+// Recursive reference of the front to back order
+static u32 test_bsp_order(const bsp* tree, u32 index, vec3 eye, u32* order, u32 count)
+{
+   if(index == bsp_null_index)
+      return count;
+
+   const bsp_node* node = tree->nodes + index;
+   bool in_back = g_plane_classify_vertex_side((g_plane*)&node->plane, eye.data) == G_PLANE_BACK;
+
+   count = test_bsp_order(tree, in_back ? node->back : node->front, eye, order, count);
+   for(u32 i = 0; i < node->face_count; ++i)
+      order[count++] = node->first_face + i;
+
+   return test_bsp_order(tree, in_back ? node->front : node->back, eye, order, count);
+}
+
+// A cube needs no splits and from outside its faces towards the eye come first, then a random soup
+// keeps its area through the splits and is ordered like the recursive reference
+static void test_bsp()
+{
+   enum { soup_count = 2000 };
+
+   arena a = arena_new(MB(16), 0);
+   arena scratch = arena_new(MB(64), 0);
+   f32* faces = new(&a, f32, soup_count*9);
+   u32* order = new(&a, u32, 8*soup_count);
+   u32* expected = new(&a, u32, 8*soup_count);
+   test_check(scratch.header && !arena_end(&a, expected), "out of memory");
+   if(test_failures)
+      return;
+
+   test_cube_faces(faces);
+   bsp cube = bsp_build(&a, scratch, faces, 12);
+   test_check(cube.face_count == 12 && cube.node_count > 0, "cube built %u faces in %u nodes", cube.face_count, cube.node_count);
+   test_check(test_bsp_node(&cube, 0, 0, 0, 0) == cube.node_count, "cube nodes not all reachable");
+
+   const vec3 eyes[] = {{{0.3f, 0.2f, 5.0f}}, {{3.0f, 4.0f, 5.0f}}, {{-2.0f, 0.5f, -0.1f}}, {{0.0f, -9.0f, 0.0f}}};
+   for(i32 e = 0; e < countof(eyes); ++e)
+   {
+      u32 count = bsp_traverse_front_to_back(&cube, eyes[e], scratch, order);
+      test_check(count == 12, "eye %d: %u faces", e, count);
+
+      // no face turned away from the eye comes before one facing it
+      bool away_seen = false;
+      u32 facing = 0;
+      for(u32 i = 0; i < count; ++i)
+      {
+         g_plane plane;
+         bsp_face_plane(&plane, cube.faces + order[i]*9);
+         bool towards = g_plane_classify_vertex_side(&plane, (f32*)eyes[e].data) == G_PLANE_FRONT;
+
+         test_check(!(towards && away_seen), "eye %d: face %u facing the eye after one turned away", e, order[i]);
+         away_seen |= !towards;
+         facing += towards;
+      }
+      test_check(facing >= 2 && facing <= 6, "eye %d sees %u faces", e, facing);
+   }
+
+   // random triangles in a box, split wherever they cross a chosen plane
+   f64 area = 0.0;
+   for(i32 i = 0; i < soup_count; ++i)
+   {
+      f32 c[3] = {test_uniform(-10.0f, 10.0f), test_uniform(-10.0f, 10.0f), test_uniform(-10.0f, 10.0f)};
+      for(i32 k = 0; k < 9; ++k)
+         faces[i*9 + k] = c[k % 3] + test_uniform(-1.0f, 1.0f);
+      area += test_face_area(faces + i*9);
+   }
+
+   bsp soup = bsp_build(&a, scratch, faces, soup_count);
+   test_check(soup.node_count > 0 && soup.face_count >= soup_count && soup.face_count <= 8*soup_count, "soup built %u faces", soup.face_count);
+   if(test_failures)
+      return;
+
+   f64 built = 0.0;
+   for(u32 i = 0; i < soup.face_count; ++i)
+      built += test_face_area(soup.faces + i*9);
+   test_check(fabs(built - area) <= 1e-4*area, "splits changed the area from %g to %g", area, built);
+   test_check(test_bsp_node(&soup, 0, 0, 0, 0) == soup.node_count, "soup nodes not all reachable");
+
+   for(i32 e = 0; e < 20; ++e)
+   {
+      vec3 eye = {{test_uniform(-15.0f, 15.0f), test_uniform(-15.0f, 15.0f), test_uniform(-15.0f, 15.0f)}};
+      u32 count = bsp_traverse_front_to_back(&soup, eye, scratch, order);
+      u32 reference = test_bsp_order(&soup, 0, eye, expected, 0);
+      test_check(count == soup.face_count && count == reference && memcmp(order, expected, count*sizeof(u32)) == 0,
+                 "eye %d: order differs from the reference", e);
+   }
+
+   arena_free(&scratch);
+   arena_free(&a);
+}
+
+enum { TEST_BVH_COUNT = 3000, TEST_BVH_ROUNDS = 50 };
+
+static bool test_aabb_contains(const g_aabb* outer, const g_aabb* inner)
+{
+   return outer->min.x <= inner->min.x && outer->min.y <= inner->min.y && outer->min.z <= inner->min.z &&
+          outer->max.x >= inner->max.x && outer->max.y >= inner->max.y && outer->max.z >= inner->max.z;
+}
+
+// Every node box holds its children or its objects, returns the objects below the node
+static u32 test_bvh_node(const bvh* tree, const g_aabb* boxes, u32 index, u32* seen)
+{
+   const bvh_node* node = tree->nodes + index;
+   if(node->count > 0)
+   {
+      for(u32 i = 0; i < node->count; ++i)
+      {
+         u32 object = tree->indexes[node->first + i];
+         test_check(test_aabb_contains(&node->box, boxes + object), "node %u does not hold object %u", index, object);
+         seen[object]++;
+      }
+      return node->count;
+   }
+
+   test_check(node->first % 2 == 0 && node->first + 1 < tree->node_count, "node %u children at %u", index, node->first);
+   test_check(test_aabb_contains(&node->box, &tree->nodes[node->first].box) && test_aabb_contains(&node->box, &tree->nodes[node->first + 1].box),
+              "node %u does not hold its children", index);
+
+   return test_bvh_node(tree, boxes, node->first, seen) + test_bvh_node(tree, boxes, node->first + 1, seen);
+}
+
+static int test_u32_compare(const void* a, const void* b)
+{
+   u32 x = *(const u32*)a, y = *(const u32*)b;
+   return (x > y) - (x < y);
+}
+
+// Frustum and ray queries against a scan of every box
+static void test_bvh_queries(const bvh* tree, const g_aabb* boxes, arena scratch, u32* expected, u32* visible, const char* kind)
+{
+   for(i32 round = 0; round < TEST_BVH_ROUNDS; ++round)
+   {
+      g_frustum frustum;
+      mat4 projection = mat4_perspective_fov(test_uniform(30.0f, 120.0f), test_uniform(0.5f, 2.5f), 0.5f, test_uniform(20.0f, 200.0f));
+      g_frustum_from_matrix(&frustum, mat4_mul(test_random_affine(), projection));
+
+      u32 count = 0;
+      for(u32 i = 0; i < TEST_BVH_COUNT; ++i)
+      {
+         u32 mask = (1u << G_FRUSTUM_PLANE_COUNT) - 1;
+         if(bvh_frustum_test(g_frustum_planes(&frustum), boxes + i, &mask))
+            expected[count++] = i;
+      }
+
+      // the query order follows the tree
+      u32 found = bvh_query_frustum(tree, boxes, &frustum, scratch, visible);
+      qsort(visible, found, sizeof(u32), test_u32_compare);
+      test_check(test_same_visible(expected, count, visible, found), "%s frustum %d: %u visible, not %u", kind, round, found, count);
+
+      vec3 origin = {{test_uniform(-200.0f, 200.0f), test_uniform(-200.0f, 200.0f), test_uniform(-200.0f, 200.0f)}};
+      vec3 target = {{test_uniform(-100.0f, 100.0f), test_uniform(-100.0f, 100.0f), test_uniform(-100.0f, 100.0f)}};
+      vec3 dir = vec3_sub(&origin, &target);
+      f32 length = sqrtf(vec3_len2(dir));
+      dir.x /= length; dir.y /= length; dir.z /= length;
+
+      vec3 inv_dir = {{1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z}};
+      f32 tmax = test_uniform(50.0f, 500.0f), nearest = FLT_MAX;
+      for(u32 i = 0; i < TEST_BVH_COUNT; ++i)
+      {
+         f32 t = bvh_ray_box(boxes + i, origin, inv_dir, tmax);
+         nearest = t < nearest ? t : nearest;
+      }
+
+      // ties between boxes may resolve to either, the distance may not
+      f32 t = 0.0f;
+      u32 hit = bvh_query_ray(tree, boxes, origin, dir, tmax, scratch, &t);
+      if(nearest == FLT_MAX)
+         test_check(hit == bvh_null_index, "%s ray %d: hit %u on a miss", kind, round, hit);
+      else
+         test_check(hit != bvh_null_index && t == nearest && bvh_ray_box(boxes + hit, origin, inv_dir, tmax) == nearest,
+                    "%s ray %d: hit %u at %g, not at %g", kind, round, hit, t, nearest);
+   }
+}
+
+static void test_bvh()
+{
+   arena a = arena_new(MB(4), 0);
+   arena scratch = arena_new(MB(4), 0);
+   g_aabb* boxes = new(&a, g_aabb, TEST_BVH_COUNT);
+   u32* expected = new(&a, u32, TEST_BVH_COUNT);
+   u32* visible = new(&a, u32, TEST_BVH_COUNT);
+   u32* seen = new(&a, u32, TEST_BVH_COUNT);
+   test_check(scratch.header && !arena_end(&a, seen), "out of memory");
+   if(test_failures)
+      return;
+
+   for(u32 i = 0; i < TEST_BVH_COUNT; ++i)
+   {
+      vec3 c = {{test_uniform(-150.0f, 150.0f), test_uniform(-150.0f, 150.0f), test_uniform(-150.0f, 150.0f)}};
+      vec3 e = {{test_uniform(0.1f, 5.0f), test_uniform(0.1f, 5.0f), test_uniform(0.1f, 5.0f)}};
+      boxes[i] = (g_aabb){{{c.x - e.x, c.y - e.y, c.z - e.z}}, {{c.x + e.x, c.y + e.y, c.z + e.z}}};
+   }
+
+   bvh tree = bvh_build(&a, scratch, boxes, TEST_BVH_COUNT);
+   test_check(tree.node_count > 0 && tree.count == TEST_BVH_COUNT, "built %u nodes over %u objects", tree.node_count, tree.count);
+   if(test_failures)
+      return;
+
+   memset(seen, 0, TEST_BVH_COUNT*sizeof(u32));
+   test_check(test_bvh_node(&tree, boxes, 0, seen) == TEST_BVH_COUNT, "leaves do not hold every object");
+   for(u32 i = 0; i < TEST_BVH_COUNT; ++i)
+      test_check(seen[i] == 1, "object %u in %u leaves", i, seen[i]);
+
+   test_bvh_queries(&tree, boxes, scratch, expected, visible, "built");
+
+   // move every object, the refit boxes must hold them again
+   for(u32 i = 0; i < TEST_BVH_COUNT; ++i)
+   {
+      vec3 d = {{test_uniform(-20.0f, 20.0f), test_uniform(-20.0f, 20.0f), test_uniform(-20.0f, 20.0f)}};
+      boxes[i].min = vec3_add(&boxes[i].min, &d);
+      boxes[i].max = vec3_add(&boxes[i].max, &d);
+   }
+
+   bvh_refit(&tree, boxes);
+   memset(seen, 0, TEST_BVH_COUNT*sizeof(u32));
+   test_check(test_bvh_node(&tree, boxes, 0, seen) == TEST_BVH_COUNT, "refit leaves do not hold every object");
+
+   test_bvh_queries(&tree, boxes, scratch, expected, visible, "refit");
+
+   arena_free(&scratch);
+   arena_free(&a);
+}
+
+enum { TEST_QUEUE_COUNT = 5000 };
+
+static int test_usize_compare(const void* a, const void* b)
+{
+   usize x = *(const usize*)a, y = *(const usize*)b;
+   return (x > y) - (x < y);
+}
+
+// Pops everything, the keys must come out as the sorted input and every node exactly once
+static void test_priority_queue_drain(priority_queue* queue, const usize* sorted, usize count, u8* seen, const char* kind, u32 arity)
+{
+   memset(seen, 0, count);
+   test_check(queue->count == count && priority_queue_invariant(queue), "%s arity %u: %zu queued, not %zu", kind, arity, (size_t)queue->count, (size_t)count);
+
+   for(usize i = 0; i < count && !priority_queue_empty(queue); ++i)
+   {
+      test_node node = priority_queue_remove(queue);
+      test_check(node.index == sorted[i] && node.order < count && !seen[node.order], "%s arity %u: pop %zu is %zu, not %zu",
+                 kind, arity, (size_t)i, (size_t)node.index, (size_t)sorted[i]);
+      if(node.order < count)
+         seen[node.order] = 1;
+   }
+   test_check(priority_queue_empty(queue), "%s arity %u: %zu left over", kind, arity, (size_t)queue->count);
+}
+
+static void test_priority_queue()
+{
+   arena a = arena_new(MB(1), 0);
+   test_node* nodes = new(&a, test_node, TEST_QUEUE_COUNT);
+   usize* sorted = new(&a, usize, TEST_QUEUE_COUNT);
+   u8* seen = new(&a, u8, TEST_QUEUE_COUNT);
+   test_check(!arena_end(&a, seen), "out of memory");
+   if(test_failures)
+      return;
+
+   // few distinct keys so many are equal
+   for(u32 i = 0; i < TEST_QUEUE_COUNT; ++i)
+   {
+      nodes[i].index = (usize)(test_random() % (TEST_QUEUE_COUNT/4));
+      nodes[i].order = i;
+      sorted[i] = nodes[i].index;
+   }
+   qsort(sorted, TEST_QUEUE_COUNT, sizeof(usize), test_usize_compare);
+
+   for(u32 arity = 2; arity <= 8; arity *= 2)
+   {
+      arena_checkpoint mark = arena_mark(&a);
+      priority_queue inserted, heapified;
+      test_check(priority_queue_init(&inserted, &a, arity, TEST_QUEUE_COUNT) && priority_queue_init(&heapified, &a, arity, TEST_QUEUE_COUNT),
+                 "arity %u: out of memory", arity);
+      if(test_failures)
+         return;
+
+      for(u32 i = 0; i < TEST_QUEUE_COUNT; ++i)
+         priority_queue_insert(&inserted, nodes[i]);
+      test_priority_queue_drain(&inserted, sorted, TEST_QUEUE_COUNT, seen, "insert", arity);
+
+      test_check(priority_queue_heapify(&heapified, nodes, TEST_QUEUE_COUNT), "arity %u: heapify failed", arity);
+      test_priority_queue_drain(&heapified, sorted, TEST_QUEUE_COUNT, seen, "heapify", arity);
+
+      // interleaved, the top is always the smallest key still queued
+      usize smallest = (usize)-1;
+      for(u32 i = 0; i < TEST_QUEUE_COUNT; ++i)
+      {
+         priority_queue_insert(&inserted, nodes[i]);
+         smallest = nodes[i].index < smallest ? nodes[i].index : smallest;
+         if(i % 3 == 2)
+         {
+            test_node top = priority_queue_remove(&inserted);
+            test_check(top.index == smallest, "arity %u: popped %zu with %zu queued", arity, (size_t)top.index, (size_t)smallest);
+
+            smallest = (usize)-1;
+            for(usize k = 0; k < inserted.count; ++k)
+               smallest = inserted.elements[k].index < smallest ? inserted.elements[k].index : smallest;
+         }
+      }
+      test_check(priority_queue_invariant(&inserted), "arity %u: interleaved heap broken", arity);
+
+      arena_rewind(&a, mark);
+   }
+
+   arena_free(&a);
+}
+
+// Grows well past the old 4096 cap, in place while the elements end the arena and by a move otherwise
+static void test_priority_queue_growth()
+{
+   enum { count = 4*TEST_QUEUE_COUNT };
+
+   arena a = arena_new(MB(4), 0);
+   arena growable = arena_new_growable(MB(16), KB(64), 0);
+   arena tiny = arena_new(KB(4), 0);
+   test_node* nodes = new(&a, test_node, count);
+   usize* sorted = new(&a, usize, count);
+   u8* seen = new(&a, u8, count);
+   test_check(growable.header && tiny.header && !arena_end(&a, seen), "out of memory");
+   if(test_failures)
+      return;
+
+   for(u32 i = 0; i < count; ++i)
+   {
+      nodes[i].index = (usize)test_random();
+      nodes[i].order = i;
+      sorted[i] = nodes[i].index;
+   }
+   qsort(sorted, count, sizeof(usize), test_usize_compare);
+
+   arena* arenas[] = {&a, &growable};
+   for(i32 k = 0; k < countof(arenas); ++k)
+   {
+      priority_queue queue;
+      test_check(priority_queue_init(&queue, arenas[k], 4, 0), "arena %d: init failed", k);
+
+      priority_queue_insert(&queue, nodes[0]);
+      test_node* first = queue.elements;
+      for(u32 i = 1; i < count/2; ++i)
+         test_check(priority_queue_insert(&queue, nodes[i]), "arena %d: insert %u failed", k, i);
+      test_check(queue.elements == first && queue.capacity >= count/2, "arena %d: moved while it ended the arena", k);
+
+      // another allocation after the elements makes the next growth move them
+      byte* other = new(arenas[k], byte, 1);
+      for(u32 i = count/2; i < count; ++i)
+         test_check(priority_queue_insert(&queue, nodes[i]), "arena %d: insert %u failed", k, i);
+      test_check(!arena_end(arenas[k], other) && queue.elements != first, "arena %d: did not move past another allocation", k);
+
+      test_priority_queue_drain(&queue, sorted, count, seen, "growth", 4);
+   }
+
+   // out of memory fails the insert and keeps what was queued
+   priority_queue queue;
+   test_check(priority_queue_init(&queue, &tiny, 2, 1), "tiny init failed");
+   u32 inserted = 0;
+   while(inserted < count && priority_queue_insert(&queue, nodes[inserted]))
+      inserted++;
+   test_check(inserted > 0 && inserted < count && queue.count == inserted && priority_queue_invariant(&queue),
+              "tiny arena took %u of %u", inserted, count);
+
+   arena_free(&tiny);
+   arena_free(&growable);
+   arena_free(&a);
+}
+
+// Random inserts, key changes both ways and removes against a shadow array of the queued keys
+static void test_indexed_queue()
+{
+   enum { handle_count = 2000, operation_count = 50000 };
+
+   arena a = arena_new(MB(1), 0);
+   f32* keys = new(&a, f32, handle_count);
+   u8* queued = new(&a, u8, handle_count);
+   test_check(!arena_end(&a, queued), "out of memory");
+   if(test_failures)
+      return;
+
+   for(u32 arity = 2; arity <= 8; arity *= 2)
+   {
+      arena_checkpoint mark = arena_mark(&a);
+      indexed_queue queue;
+      test_check(indexed_queue_init(&queue, &a, handle_count, arity), "arity %u: out of memory", arity);
+      if(test_failures)
+         return;
+
+      memset(queued, 0, handle_count);
+      u32 count = 0;
+      for(u32 n = 0; n < operation_count; ++n)
+      {
+         u32 handle = test_random() % handle_count;
+         if(test_random() % 4 == 0)
+         {
+            test_check(indexed_queue_remove(&queue, handle) == (queued[handle] != 0), "arity %u: remove %u", arity, handle);
+            count -= queued[handle];
+            queued[handle] = 0;
+         }
+         else
+         {
+            // coarse keys so equal ones are common
+            keys[handle] = (f32)(test_random() % 500);
+            indexed_queue_update_key(&queue, handle, keys[handle]);
+            count += !queued[handle];
+            queued[handle] = 1;
+         }
+
+         test_check(queue.count == count && indexed_queue_invariant(&queue), "arity %u: heap broken after operation %u", arity, n);
+         test_check(indexed_queue_contains(&queue, handle) == (queued[handle] != 0), "arity %u: handle %u queued wrong", arity, handle);
+         if(queued[handle])
+            test_check(indexed_queue_get_key(&queue, handle) == keys[handle], "arity %u: handle %u has the wrong key", arity, handle);
+         if(test_failures)
+            return;
+      }
+
+      f32 last = -1.0f;
+      while(!indexed_queue_empty(&queue))
+      {
+         indexed_queue_entry top = indexed_queue_pop(&queue);
+         test_check(top.key >= last && queued[top.handle] && top.key == keys[top.handle], "arity %u: popped %u with key %g after %g",
+                    arity, top.handle, top.key, last);
+         queued[top.handle] = 0;
+         last = top.key;
+         count--;
+      }
+      test_check(count == 0, "arity %u: %u handles never popped", arity, count);
+
+      // clear leaves every handle free to insert again
+      for(u32 h = 0; h < handle_count; h += 7)
+         indexed_queue_insert(&queue, h, (f32)h);
+      indexed_queue_clear(&queue);
+      for(u32 h = 0; h < handle_count; ++h)
+         test_check(!indexed_queue_contains(&queue, h), "arity %u: handle %u queued after clear", arity, h);
+
+      arena_rewind(&a, mark);
+   }
+
+   arena_free(&a);
+}
+
+typedef struct test_keyed { u64 key; u32 value; } test_keyed;
+
+// key first and the original position second, so qsort gives the stable order
+static int test_keyed_compare(const void* a, const void* b)
+{
+   const test_keyed* x = a;
+   const test_keyed* y = b;
+   if(x->key != y->key)
+      return x->key < y->key ? -1 : 1;
+   return (x->value > y->value) - (x->value < y->value);
+}
+
+// Draws keys of one shape: all bits, a few low bits, only high bits or all equal
+static u64 test_radix_key(i32 shape, i32 bits)
+{
+   u64 key = (u64)test_random() << 32 | test_random();
+   switch(shape)
+   {
+   case 0: break;
+   case 1: key &= 0x3ff; break;
+   case 2: key = (key >> (bits - 8)) << (bits - 8); break;
+   default: key = 0x5a5a5a5a5a5a5a5aull; break;
+   }
+
+   return bits == 32 ? (u32)key : key;
+}
+
+// Sorted keys with the payloads of equal keys still in input order, with and without payloads
+static void test_radix_sort()
+{
+   enum { max_count = 20000 };
+
+   arena a = arena_new(MB(4), 0);
+   arena scratch = arena_new(MB(4), 0);
+   test_keyed* expected = new(&a, test_keyed, max_count);
+   u64* keys64 = new(&a, u64, max_count);
+   u32* keys32 = new(&a, u32, max_count);
+   u32* values = new(&a, u32, max_count);
+   test_check(scratch.header && !arena_end(&a, values), "out of memory");
+   if(test_failures)
+      return;
+
+   const size counts[] = {0, 1, 2, 3, 100, 2047, 2049, max_count};
+   for(i32 c = 0; c < countof(counts); ++c)
+      for(i32 bits = 32; bits <= 64; bits += 32)
+         for(i32 shape = 0; shape < 4; ++shape)
+         {
+            size count = counts[c];
+            for(size i = 0; i < count; ++i)
+            {
+               expected[i].key = test_radix_key(shape, bits);
+               expected[i].value = (u32)i;
+               keys64[i] = expected[i].key;
+               keys32[i] = (u32)expected[i].key;
+               values[i] = (u32)i;
+            }
+            qsort(expected, count, sizeof(test_keyed), test_keyed_compare);
+
+            bool sorted = true, stable = true;
+            if(bits == 32)
+            {
+               test_check(radix_sort_u32(keys32, values, count, scratch), "u32 sort of %td failed", count);
+               for(size i = 0; i < count; ++i)
+               {
+                  sorted &= keys32[i] == expected[i].key;
+                  stable &= values[i] == expected[i].value;
+               }
+
+               for(size i = 0; i < count; ++i)
+                  keys32[i] = (u32)test_radix_key(shape, bits);
+               test_check(radix_sort_u32(keys32, 0, count, scratch), "u32 keys only sort of %td failed", count);
+               for(size i = 1; i < count; ++i)
+                  sorted &= keys32[i - 1] <= keys32[i];
+            }
+            else
+            {
+               test_check(radix_sort_u64(keys64, values, count, scratch), "u64 sort of %td failed", count);
+               for(size i = 0; i < count; ++i)
+               {
+                  sorted &= keys64[i] == expected[i].key;
+                  stable &= values[i] == expected[i].value;
+               }
+
+               for(size i = 0; i < count; ++i)
+                  keys64[i] = test_radix_key(shape, bits);
+               test_check(radix_sort_u64(keys64, 0, count, scratch), "u64 keys only sort of %td failed", count);
+               for(size i = 1; i < count; ++i)
+                  sorted &= keys64[i - 1] <= keys64[i];
+            }
+
+            test_check(sorted && stable, "%d bit keys of shape %d, %td of them: %s", bits, shape, count, sorted ? "not stable" : "not sorted");
+         }
+
+   // too small a scratch fails without touching the keys
+   arena tiny = arena_new(KB(4), 0);
+   for(size i = 0; i < max_count; ++i)
+      keys32[i] = (u32)(max_count - i);
+   test_check(!radix_sort_u32(keys32, values, max_count, tiny) && keys32[0] == max_count, "sort with a tiny scratch");
+
+   arena_free(&tiny);
+   arena_free(&scratch);
+   arena_free(&a);
+}
+
+// Keys rising well past the bucket count so the buckets wrap, pops must follow the smallest shadow key
+static void test_bucket_queue()
+{
+   enum { handle_count = 1000, bucket_count = 64, operation_count = 100000 };
+
+   arena a = arena_new(KB(64), 0);
+   u32* keys = new(&a, u32, handle_count);
+   u8* queued = new(&a, u8, handle_count);
+   bucket_queue queue;
+   test_check(!arena_end(&a, queued) && bucket_queue_init(&queue, &a, handle_count, bucket_count), "out of memory");
+   if(test_failures)
+      return;
+
+   memset(queued, 0, handle_count);
+   u32 count = 0, last = 0, pops = 0;
+   for(u32 n = 0; n < operation_count; ++n)
+   {
+      u32 handle = test_random() % handle_count;
+      u32 op = test_random() % 8;
+
+      if(op < 4)
+      {
+         // new keys stay within the bucket count of the last pop
+         keys[handle] = last + test_random() % bucket_count;
+         bucket_queue_update_key(&queue, handle, keys[handle]);
+         count += !queued[handle];
+         queued[handle] = 1;
+      }
+      else if(op == 4)
+      {
+         test_check(bucket_queue_remove(&queue, handle) == (queued[handle] != 0), "remove %u", handle);
+         count -= queued[handle];
+         queued[handle] = 0;
+      }
+      else if(count > 0)
+      {
+         u32 smallest = (u32)-1;
+         for(u32 h = 0; h < handle_count; ++h)
+            if(queued[h] && keys[h] < smallest)
+               smallest = keys[h];
+
+         u32 key = 0;
+         u32 popped = bucket_queue_pop(&queue, &key);
+         test_check(popped < handle_count && queued[popped] && key == smallest && keys[popped] == key,
+                    "pop %u: handle %u with key %u, the smallest is %u", n, popped, key, smallest);
+         if(test_failures)
+            return;
+
+         queued[popped] = 0;
+         last = key;
+         count--;
+         pops++;
+      }
+
+      test_check(queue.count == count, "operation %u: %u queued, not %u", n, queue.count, count);
+   }
+   test_check(last > 4*bucket_count, "keys only reached %u in %u pops", last, pops);
+
+   // equal keys come out last in first out
+   while(!bucket_queue_empty(&queue))
+      bucket_queue_pop(&queue, &last);
+   for(u32 h = 0; h < 10; ++h)
+      bucket_queue_insert(&queue, h, last + 1);
+   for(u32 h = 10; h-- > 0;)
+      test_check(bucket_queue_pop(&queue, 0) == h, "equal keys not last in first out at %u", h);
+
+   arena_free(&a);
+}
+
+enum { TEST_PUSHES_PER_THREAD = 20000 };
+
+typedef struct test_queue_thread
+{
+   multi_queue* queue;
+   u64* popped;      // values in the order this thread got them
+   u32 popped_count;
+   u32 first;        // values first to first + TEST_PUSHES_PER_THREAD - 1 are this thread's
+   u32 seed;
+   bool failed;      // a push found no room
+} test_queue_thread;
+
+// Pushes its values under random keys and pops after every second push, then drains
+static void* test_thread_multi_queue(void* p)
+{
+   test_queue_thread* t = p;
+   u32 x = t->seed;
+   multi_queue_entry entry;
+
+   for(u32 i = 0; i < TEST_PUSHES_PER_THREAD; ++i)
+   {
+      x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+
+      t->failed |= !multi_queue_push(t->queue, x % 1000, t->first + i);
+      if((i & 1) && multi_queue_pop(t->queue, &entry))
+         t->popped[t->popped_count++] = entry.value;
+   }
+   while(multi_queue_pop(t->queue, &entry))
+      t->popped[t->popped_count++] = entry.value;
+
+   return 0;
+}
+
+// Producers and consumers at once on shards that fill up, every value has to come out exactly once
+static void test_multi_queue()
+{
+   enum { count = TEST_THREADS*TEST_PUSHES_PER_THREAD, shard_count = 2*TEST_THREADS };
+
+   // a thread may pop the values of the others too
+   arena a = arena_new(MB(32), 0);
+   u64* popped = new(&a, u64, TEST_THREADS*count);
+   u8* seen = new(&a, u8, count);
+   multi_queue queue;
+   test_check(!arena_end(&a, seen) && multi_queue_init(&queue, &a, shard_count, count/shard_count + 64), "out of memory");
+   if(test_failures)
+      return;
+
+   pthread_t threads[TEST_THREADS];
+   test_queue_thread args[TEST_THREADS];
+
+   for(i32 i = 0; i < TEST_THREADS; ++i)
+   {
+      args[i].queue = &queue;
+      args[i].popped = popped + i*count;
+      args[i].popped_count = 0;
+      args[i].first = i*TEST_PUSHES_PER_THREAD;
+      args[i].seed = test_random() | 1;
+      args[i].failed = false;
+      pthread_create(&threads[i], 0, test_thread_multi_queue, &args[i]);
+   }
+
+   memset(seen, 0, count);
+   u32 total = 0;
+   for(i32 i = 0; i < TEST_THREADS; ++i)
+   {
+      pthread_join(threads[i], 0);
+      test_check(!args[i].failed, "thread %d found every shard full", i);
+      for(u32 k = 0; k < args[i].popped_count; ++k)
+      {
+         u64 value = args[i].popped[k];
+         test_check(value < count && !seen[value], "value %llu popped twice or never pushed", (unsigned long long)value);
+         if(value < count)
+            seen[value]++;
+      }
+      total += args[i].popped_count;
+   }
+
+   // a thread may finish draining while another still pushes
+   multi_queue_entry entry;
+   while(multi_queue_pop(&queue, &entry))
+   {
+      test_check(entry.value < count && !seen[entry.value], "value %llu popped twice or never pushed", (unsigned long long)entry.value);
+      if(entry.value < count)
+         seen[entry.value]++;
+      total++;
+   }
+
+   test_check(total == count, "%u of %u values popped", total, (u32)count);
+   for(u32 i = 0; i < count; ++i)
+      test_check(seen[i] == 1, "value %u popped %u times", i, seen[i]);
+
+   // a single thread on a single shard pops in key order
+   multi_queue single;
+   test_check(multi_queue_init(&single, &a, 1, 1000), "out of memory");
+   for(u32 i = 0; i < 1000; ++i)
+      multi_queue_push(&single, test_random() % 100, i);
+   u64 last = 0;
+   for(u32 i = 0; multi_queue_pop(&single, &entry); ++i)
+   {
+      test_check(entry.key >= last, "pop %u: key %llu after %llu", i, (unsigned long long)entry.key, (unsigned long long)last);
+      last = entry.key;
+   }
+
+   arena_free(&a);
+}
+
+int main(int argc, char** argv)
+{
+   hw_virtual_memory_init();
+
+   if(argc > 1)
+      test_filter = argv[1];
+
+   bool ok = true;
+
+   ok &= test_run("alloc_atomic_mixed", test_alloc_atomic_mixed);
+   ok &= test_run("alloc_atomic_uniform", test_alloc_atomic_uniform);
+   ok &= test_run("alloc_atomic_growable", test_alloc_atomic_growable);
+   ok &= test_run("arena_growable_commit", test_arena_growable_commit);
+   ok &= test_run("scratch_reset", test_scratch_reset);
+   ok &= test_run("arena_rewind", test_arena_rewind);
+   ok &= test_run("pool_generations", test_pool_generations);
+#if defined(ARENA_TELEMETRY)
+   ok &= test_run("arena_telemetry", test_arena_telemetry);
+#endif
+   ok &= test_run("vec4_backend", test_vec4_backend);
+   ok &= test_run("mat4_backend", test_mat4_backend);
+   ok &= test_run("transform_soa", test_transform_soa);
+   ok &= test_run("fixed4_backend", test_fixed4_backend);
+   ok &= test_run("mat4_inverse_affine", test_mat4_inverse_affine);
+   ok &= test_run("mat4_inverse_perspective", test_mat4_inverse_perspective);
+   ok &= test_run("mat4_inverse_near_singular", test_mat4_inverse_near_singular);
+   ok &= test_run("frustum_from_matrix", test_frustum_from_matrix);
+   ok &= test_run("frustum_cull_backend", test_frustum_cull_backend);
+   ok &= test_run("bsp", test_bsp);
+   ok &= test_run("bvh", test_bvh);
+   ok &= test_run("priority_queue", test_priority_queue);
+   ok &= test_run("priority_queue_growth", test_priority_queue_growth);
+   ok &= test_run("indexed_queue", test_indexed_queue);
+   ok &= test_run("radix_sort", test_radix_sort);
+   ok &= test_run("bucket_queue", test_bucket_queue);
+   ok &= test_run("multi_queue", test_multi_queue);
+
+   return ok ? 0 : 1;
+}
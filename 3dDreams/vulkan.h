@@ -4,7 +4,7 @@
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #define VK_USE_PLATFORM_WIN32_KHR
-#elif
+#else
 // other plats for vulkan
 #endif
 
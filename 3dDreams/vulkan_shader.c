@@ -66,6 +66,9 @@ static bool vulkan_shader_create(arena scratch, vulkan_context* context)
 
    for(u32 i = 0; i < OBJECT_SHADER_COUNT; ++i)
    {
+      // the spv code is only needed until the module is created
+      arena_checkpoint spv_mark = arena_mark(context->storage);
+
       file_result shader_file = vulkan_shader_spv_read(context, shader_dir.data, shader_type_bits[i]);
       if(shader_file.file_size == 0)
          return false;
@@ -80,6 +83,9 @@ static bool vulkan_shader_create(arena scratch, vulkan_context* context)
                            &context->shader.stages[i].handle)))
          return false;
 
+      arena_rewind(context->storage, spv_mark);
+      context->shader.stages[i].module_create_info.pCode = 0;
+
       context->shader.stages[i].pipeline_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
       context->shader.stages[i].pipeline_create_info.stage = shader_type_bits[i];
       context->shader.stages[i].pipeline_create_info.module = context->shader.stages[i].handle;
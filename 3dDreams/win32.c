@@ -158,9 +158,11 @@ static void win32_abort(u32 code)
 #define hw_error(m) MessageBox(NULL, (m), "Engine", MB_OK | MB_ICONSTOP | MB_SYSTEMMODAL);
 
 typedef LPVOID(*VirtualAllocPtr)(LPVOID, SIZE_T, DWORD, DWORD);
-typedef VOID(*VirtualReleasePtr)(LPVOID, SIZE_T);
+typedef BOOL(*VirtualReleasePtr)(LPVOID, SIZE_T, DWORD);
 static VirtualAllocPtr global_allocate = 0;
 static VirtualReleasePtr global_release = 0;
+static usize global_page_size = 0;
+static usize global_large_page_size = 0;  // zero when large pages are not available
 
 static void hw_global_reserve_available()
 {
@@ -196,27 +198,57 @@ static void* hw_virtual_memory_reserve(usize size)
    return global_allocate(0, size, MEM_RESERVE, PAGE_NOACCESS);
 }
 
-static void hw_virtual_memory_commit(void* address, usize size)
+// Large pages are reserved and committed at once, they are never paged out
+static void* hw_virtual_memory_reserve_large(usize size)
+{
+   if(global_large_page_size == 0)
+      return 0;
+
+   pre((size & (global_large_page_size - 1)) == 0);
+
+   return global_allocate(0, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+}
+
+static void hw_virtual_memory_large_pages_init()
+{
+   HANDLE token;
+   if(!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+      return;
+
+   TOKEN_PRIVILEGES privileges = {0};
+   privileges.PrivilegeCount = 1;
+   privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+   // the call succeeds without the privilege being held so check the last error too
+   if(LookupPrivilegeValue(0, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+      AdjustTokenPrivileges(token, FALSE, &privileges, 0, 0, 0) && GetLastError() == ERROR_SUCCESS)
+      global_large_page_size = GetLargePageMinimum();
+
+   CloseHandle(token);
+}
+
+static bool hw_virtual_memory_commit(void* address, usize size)
 {
 	pre(hw_is_virtual_memory_reserved((byte*)address+size-1));
 	pre(!hw_is_virtual_memory_commited((byte*)address+size-1));
 
 	// commit the reserved address range
-   global_allocate(address, size, MEM_COMMIT, PAGE_READWRITE);
+   return global_allocate(address, size, MEM_COMMIT, PAGE_READWRITE) != 0;
 }
 
 static void hw_virtual_memory_release(void* address, usize size)
 {
-	pre(hw_is_virtual_memory_commited((byte*)address+size-1));
+	pre(address);
 
-	global_release(address, size);
+   // the whole reservation is released at once
+	global_release(address, 0, MEM_RELEASE);
 }
 
 static void hw_virtual_memory_decommit(void* address, usize size)
 {
 	pre(hw_is_virtual_memory_commited((byte*)address+size-1));
 
-	global_allocate(address, size, MEM_DECOMMIT, PAGE_READWRITE);
+	global_release(address, size, MEM_DECOMMIT);
 }
 
 static void hw_virtual_memory_init()
@@ -230,36 +262,130 @@ static void hw_virtual_memory_init()
    global_allocate = (VirtualAllocPtr)(GetProcAddress(hkernel32, "VirtualAlloc"));
    global_release = (VirtualReleasePtr)(GetProcAddress(hkernel32, "VirtualFree"));
 
+   SYSTEM_INFO system_info;
+   GetSystemInfo(&system_info);
+   global_page_size = system_info.dwPageSize;
+
+   hw_virtual_memory_large_pages_init();
+
    post(global_allocate);
    post(global_release);
+   post((global_page_size & (global_page_size - 1)) == 0);
+   post((global_large_page_size & (global_large_page_size - 1)) == 0);
 }
 
-static arena arena_new(size cap)
+static arena arena_new(size cap, u32 flags)
 {
    arena a = {}; // stub arena
-   if(cap <= 0)
+   if(cap <= (size)sizeof(arena_header))
       return a;
 
-   void* base = hw_virtual_memory_reserve(cap);
-   hw_virtual_memory_commit(base, cap);
+   byte* base = 0;
+   u32 granted = 0;
 
-   if(!VirtualLock(base, cap))
+   if((flags & ARENA_HUGE_PAGES) && global_large_page_size > 0)
    {
-      hw_virtual_memory_release(base, cap);
-      return a;
+      const size large_cap = (cap + global_large_page_size - 1) & ~(global_large_page_size - 1);
+      base = hw_virtual_memory_reserve_large(large_cap);
+      if(base)
+      {
+         cap = large_cap;
+         granted |= ARENA_HUGE_PAGES;
+      }
+   }
+
+   // fall back to normal pages
+   if(!base)
+   {
+      base = hw_virtual_memory_reserve(cap);
+      if(!base)
+         return a;
+
+      if(!hw_virtual_memory_commit(base, cap) || !VirtualLock(base, cap))
+      {
+         hw_virtual_memory_release(base, cap);
+         return a;
+      }
    }
 
+   // fully committed up front
+   arena_header* header = (arena_header*)base;
+   header->commit = base + cap;
+   header->end = base + cap;
+   header->chunk = 0;
+   header->peak = arena_first(header);
+   header->flags = granted;
+
    // set the base pointer and size on success
-   a.beg = base;
-   a.end = a.beg ? a.beg + cap : 0;
+   a.header = header;
+   a.beg = arena_first(header);
+   a.end = header->end;
 
    return a;
 }
 
+// reserves the whole range but only commits chunk sized pieces as the arena grows,
+// large pages cannot be committed piecewise so they are never granted here
+static arena arena_new_growable(size reserve, size chunk, u32 flags)
+{
+   arena a = {}; // stub arena
+   if(reserve <= (size)sizeof(arena_header) || chunk <= 0)
+      return a;
+
+   // commit in whole pages
+   chunk = (chunk + global_page_size - 1) & ~(global_page_size - 1);
+   const size first = chunk < reserve ? chunk : reserve;
+
+   byte* base = hw_virtual_memory_reserve(reserve);
+   if(!base)
+      return a;
+
+   // the first chunk holds the header
+   if(!hw_virtual_memory_commit(base, first))
+   {
+      hw_virtual_memory_release(base, reserve);
+      return a;
+   }
+
+   arena_header* header = (arena_header*)base;
+   header->commit = base + first;
+   header->end = base + reserve;
+   header->chunk = chunk;
+   header->peak = arena_first(header);
+   header->flags = 0;
+
+   a.header = header;
+   a.beg = arena_first(header);
+   a.end = header->end;
+
+   return a;
+}
+
+bool arena_pages_commit(void* address, size bytes)
+{
+   return hw_virtual_memory_commit(address, bytes);
+}
+
+void arena_pages_decommit(void* address, size bytes)
+{
+   hw_virtual_memory_decommit(address, bytes);
+}
+
 static void arena_free(arena* a)
 {
-   if(VirtualUnlock(a->beg, arena_size(a)))
-      hw_virtual_memory_release(a->beg, arena_size(a));
+   arena_header* header = a->header;
+   if(!header)
+      return;
+
+   const size reserve = header->end - (byte*)header;
+
+   // only the up front committed arenas are locked, large pages are never paged out
+   if(header->chunk == 0 && !(header->flags & ARENA_HUGE_PAGES))
+      VirtualUnlock(header, reserve);
+
+   hw_virtual_memory_release(header, reserve);
+
+   *a = (arena){0};
 }
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpszCmdLine, int nCmdShow)
@@ -271,8 +397,19 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpszCmdLi
 
    hw_virtual_memory_init();
 
-   arena base_storage = hw.vulkan_storage = arena_new(virtual_memory_amount);
-   hw.vulkan_scratch = arena_new(virtual_memory_amount);
+   // storage grows on demand, scratch stays small and locked
+   hw.vulkan_storage = arena_new_growable(default_arena_reserve, virtual_memory_amount, ARENA_HUGE_PAGES);
+   hw.vulkan_scratch = arena_new(virtual_memory_amount, 0);
+
+   // without the per thread scratch pair scratch_get would hand out empty arenas
+   if(!hw.vulkan_storage.header || !hw.vulkan_scratch.header || !scratch_thread_create(virtual_memory_amount))
+   {
+      hw_error("Could not reserve the arenas");
+      arena_free(&hw.vulkan_storage);
+      arena_free(&hw.vulkan_scratch);
+      return 1;
+   }
+
    argv = cmd_parse(&hw.vulkan_storage, lpszCmdLine, &argc);
 
    hw.renderer.window.open = win32_window_open;
@@ -287,8 +424,14 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpszCmdLi
    app_start(argc, argv, &hw);
    timeEndPeriod(1);
 
-   arena_free(&base_storage);
+#if defined(ARENA_TELEMETRY)
+   arena_stats_dump(&hw.vulkan_storage, "storage", debug_message);
+   arena_stats_dump(&hw.vulkan_scratch, "scratch", debug_message);
+#endif
+
+   arena_free(&hw.vulkan_storage);
    arena_free(&hw.vulkan_scratch);
+   scratch_thread_release();
 
    return 0;
 }